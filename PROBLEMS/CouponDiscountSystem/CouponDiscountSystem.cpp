@@ -154,19 +154,51 @@ shared_ptr<DiscountStrategyFactory> DiscountStrategyFactory::instance = nullptr;
 //                CART
 //////////////////////////////////////////////////////////////////
 
+// Numbers category names densely, once, so carts and coupons can compare
+// and index categories by ID instead of by string.
+class CategoryRegistry {
+private:
+  unordered_map<string, int> ids;
+  mutex mtx;
+
+  CategoryRegistry() {}
+
+public:
+  static CategoryRegistry* getInstance() {
+    static CategoryRegistry instance;
+    return &instance;
+  }
+
+  int idOf(const string& category) {
+    lock_guard<mutex> lock(mtx);
+    auto it = ids.find(category);
+    if (it != ids.end()) return it->second;
+    int id = (int)ids.size();
+    ids[category] = id;
+    return id;
+  }
+};
+
+
 class Product {
 private:
   string name;
   string category;
+  int categoryId;
   double price;
 
 public:
   Product(string name, string category, double price){
     this->name = name;
     this->category = category;
+    this->categoryId = CategoryRegistry::getInstance()->idOf(category);
     this->price = price;
   }
 
+  int getCategoryId(){
+    return categoryId;
+  }
+
   string getName(){
     return name;
   }
@@ -197,6 +229,14 @@ public:
         return product->getPrice() * quantity;
     }
 
+  int getQuantity() {
+        return quantity;
+    }
+
+  void setQuantity(int qty) {
+        quantity = qty;
+    }
+
 
   const shared_ptr<Product> getProduct() {
         return product;
@@ -204,14 +244,47 @@ public:
 };
 
 
+// Keeps per-category subtotals and quantities up to date as items come
+// and go, so nothing has to rescan the items to price the cart.
 class Cart {
 private:
+  struct CategoryTotals {
+      double subtotal = 0.0;
+      int quantity = 0;
+      int items = 0;
+      int slot = -1;            // position in `categories` while items > 0
+  };
+
   vector<shared_ptr<CartItem>>items;
+  unordered_map<Product*, int> itemIndex;     // product -> position in items
+  vector<CategoryTotals> totalsByCategory;    // by category ID
+  vector<int> categories;                     // IDs with at least one item
   string paymentBank;
   double originalTotal;
   double currentTotal;
   bool loyaltyMember;
 
+  // Every change to an item's quantity goes through here.
+  void adjust(int categoryId, double price, int oldQty, int newQty) {
+      if (categoryId >= (int)totalsByCategory.size()) totalsByCategory.resize(categoryId + 1);
+      CategoryTotals& totals = totalsByCategory[categoryId];
+      double delta = price * (newQty - oldQty);
+      totals.subtotal += delta;
+      totals.quantity += newQty - oldQty;
+      originalTotal += delta;
+      currentTotal = max(0.0, currentTotal + delta);
+      if (oldQty == 0 && newQty > 0 && totals.items++ == 0) {
+          totals.slot = (int)categories.size();
+          categories.push_back(categoryId);
+      }
+      if (oldQty > 0 && newQty == 0 && --totals.items == 0) {
+          totalsByCategory[categories.back()].slot = totals.slot;
+          categories[totals.slot] = categories.back();
+          categories.pop_back();
+          totals = CategoryTotals();   // drop any rounding residue too
+      }
+  }
+
 public:
   Cart() {
       originalTotal = 0.0;
@@ -220,18 +293,92 @@ public:
       paymentBank = "";
     }
 
+  // A copy gets its own items: changing quantities on it never shows
+  // through in the original, whose category totals would go stale.
+  Cart(const Cart& other) {
+      *this = other;
+  }
+
+  Cart& operator=(const Cart& other) {
+      if (this == &other) return *this;
+      items.clear();
+      for (const shared_ptr<CartItem>& item : other.items) {
+          items.push_back(make_shared<CartItem>(*item));
+      }
+      itemIndex = other.itemIndex;
+      totalsByCategory = other.totalsByCategory;
+      categories = other.categories;
+      paymentBank = other.paymentBank;
+      originalTotal = other.originalTotal;
+      currentTotal = other.currentTotal;
+      loyaltyMember = other.loyaltyMember;
+      return *this;
+  }
+
+  Cart(Cart&&) = default;
+  Cart& operator=(Cart&&) = default;
+
+  // Adding a product already in the cart raises its quantity.
   void addProduct(shared_ptr<Product> prod, int qty = 1) {
-      shared_ptr<CartItem> item = make_shared<CartItem>(prod, qty);
-      items.push_back(item);
-      originalTotal += item->itemTotal();
-      currentTotal  += item->itemTotal();
+      auto it = itemIndex.find(prod.get());
+      if (it != itemIndex.end()) {
+          setQuantity(prod, items[it->second]->getQuantity() + qty);
+          return;
+      }
+      if (qty <= 0) return;
+      itemIndex[prod.get()] = (int)items.size();
+      items.push_back(make_shared<CartItem>(prod, qty));
+      adjust(prod->getCategoryId(), prod->getPrice(), 0, qty);
+  }
+
+  // A quantity of 0 or less removes the product.
+  void setQuantity(shared_ptr<Product> prod, int qty) {
+      auto it = itemIndex.find(prod.get());
+      if (it == itemIndex.end()) {
+          addProduct(prod, qty);
+          return;
+      }
+      int position = it->second;
+      shared_ptr<CartItem> item = items[position];
+      qty = max(qty, 0);
+      adjust(prod->getCategoryId(), prod->getPrice(), item->getQuantity(), qty);
+      if (qty > 0) {
+          item->setQuantity(qty);
+          return;
+      }
+      itemIndex[items.back()->getProduct().get()] = position;
+      items[position] = items.back();
+      items.pop_back();
+      itemIndex.erase(prod.get());
+  }
+
+  void removeProduct(shared_ptr<Product> prod) {
+      setQuantity(prod, 0);
+  }
+
+  bool hasCategory(int categoryId) const {
+      return categoryId < (int)totalsByCategory.size() && totalsByCategory[categoryId].items > 0;
+  }
+
+  // Full-price total of the category's items.
+  double getCategorySubtotal(int categoryId) const {
+      return categoryId < (int)totalsByCategory.size() ? totalsByCategory[categoryId].subtotal : 0.0;
+  }
+
+  int getCategoryQuantity(int categoryId) const {
+      return categoryId < (int)totalsByCategory.size() ? totalsByCategory[categoryId].quantity : 0;
+  }
+
+  // Category IDs in the cart, in no particular order.
+  const vector<int>& getCategories() const {
+      return categories;
   }
 
-  double getOriginalTotal() {
+  double getOriginalTotal() const {
       return originalTotal;
   }
 
-  double getCurrentTotal() {
+  double getCurrentTotal() const {
       return currentTotal;
   }
 
@@ -246,7 +393,7 @@ public:
       loyaltyMember = member;
   }
 
-  bool isLoyaltyMember() {
+  bool isLoyaltyMember() const {
       return loyaltyMember;
   }
 
@@ -254,16 +401,77 @@ public:
       paymentBank = bank;
   }
 
-  string getPaymentBank() {
+  string getPaymentBank() const {
       return paymentBank;
   }
 
-  vector<shared_ptr<CartItem>> getItems() {
+  const vector<shared_ptr<CartItem>>& getItems() const {
       return items;
   }
 };
 
 
+//////////////////////////////////////////////////////////////////
+//                COUPON RULES
+//////////////////////////////////////////////////////////////////
+
+// Bank names used by coupons, numbered densely. Categories use the
+// CategoryRegistry's IDs, which carts already carry.
+class CouponSymbols {
+private:
+    int categoryLimit = 0;   // one past the highest category ID seen
+    unordered_map<string, int> banks;
+
+    static int intern(unordered_map<string, int>& table, const string& name) {
+        auto it = table.find(name);
+        if (it != table.end()) return it->second;
+        int id = (int)table.size();
+        table[name] = id;
+        return id;
+    }
+
+    static int lookup(const unordered_map<string, int>& table, const string& name) {
+        auto it = table.find(name);
+        return it == table.end() ? -1 : it->second;
+    }
+
+public:
+    int categoryId(int id) {
+        categoryLimit = max(categoryLimit, id + 1);
+        return id;
+    }
+    int bankId(const string& name) { return intern(banks, name); }
+
+    // -1 if no coupon mentions it.
+    int findBank(const string& name) const { return lookup(banks, name); }
+
+    int categoryCount() const { return categoryLimit; }
+    int bankCount() const { return (int)banks.size(); }
+};
+
+class ICoupon;
+
+// A coupon reduced to data: when it applies and what it takes off.
+struct CouponRule {
+    enum class Base {
+        CURRENT_TOTAL,       // the cart total after earlier coupons
+        CATEGORY_SUBTOTAL    // the category's items at full price
+    };
+
+    int position = 0;                 // registration order
+    string name;
+    bool combinable = true;
+    int categoryId = -1;              // needs an item in this category
+    int bankId = -1;                  // needs payment through this bank
+    bool needsLoyalty = false;
+    double minOriginalTotal = 0.0;
+    Base base = Base::CURRENT_TOTAL;
+    bool fixedAmount = false;         // takes the same amount off at any running total
+    shared_ptr<IDiscountStrategy> strategy;
+    shared_ptr<ICoupon> custom;       // set for coupons that can't be compiled
+};
+
+
 // ----------------------------
 // Coupon base class (Chain of Responsibility)
 // ----------------------------
@@ -308,6 +516,12 @@ public:
     return true;
  }
  virtual string name() = 0;
+
+ // Describes this coupon as a rule; false if it can't be, in which case
+ // the CouponProgram asks the coupon itself.
+ virtual bool compile(CouponRule&, CouponSymbols&) {
+    return false;
+ }
 };
 
 
@@ -315,35 +529,24 @@ public:
 class SeasonalCoupon : public ICoupon {
 private:
     string category;
+    int categoryId;
     double percentage;
 
 public:
     SeasonalCoupon(string cat, double per){
       this->category = cat;
+      this->categoryId = CategoryRegistry::getInstance()->idOf(cat);
       this->percentage = per;
       this->discountStrategy = DiscountStrategyFactory::getInstance()->getDiscountStrategy(StrategyType::PERCENTAGE, per);
     }
 
     bool isApplicable(shared_ptr<Cart> cart) override {
-        for(shared_ptr<CartItem> item : cart->getItems()){
-          if(item->getProduct()->getCategory() == category){
-            return true;
-          }
-        }
-
-        return false;
+        return cart->hasCategory(categoryId);
     }
 
 
     double getDiscount(shared_ptr<Cart> cart) override {
-        double subtotal = 0.0;
-        for(shared_ptr<CartItem> item : cart->getItems()){
-          if(item->getProduct()->getCategory() == category){
-             subtotal += item->itemTotal();
-          }
-        }
-
-        return discountStrategy->calculateDiscount(subtotal);
+        return discountStrategy->calculateDiscount(cart->getCategorySubtotal(categoryId));
     }
 
 
@@ -353,6 +556,13 @@ public:
     string name() override {
         return "Seasonal Offer " + to_string((int)percentage) + " % off " + category;
     }
+
+    bool compile(CouponRule& rule, CouponSymbols& symbols) override {
+        rule.categoryId = symbols.categoryId(categoryId);
+        rule.base = CouponRule::Base::CATEGORY_SUBTOTAL;
+        rule.strategy = discountStrategy;
+        return true;
+    }
 };
 
 
@@ -374,6 +584,12 @@ public:
     string name() override {
         return "Loyalty Discount " + to_string((int)percent) + "% off";
     }
+
+    bool compile(CouponRule& rule, CouponSymbols&) override {
+        rule.needsLoyalty = true;
+        rule.strategy = discountStrategy;
+        return true;
+    }
 };
 
 
@@ -398,6 +614,13 @@ public:
         return "Bulk Purchase Rs " + to_string((int)flatOff) + " off over "
              + to_string((int)threshold);
     }
+
+    bool compile(CouponRule& rule, CouponSymbols&) override {
+        rule.minOriginalTotal = threshold;
+        rule.fixedAmount = true;
+        rule.strategy = discountStrategy;
+        return true;
+    }
 };
 
 class BankingCoupon : public ICoupon {
@@ -425,22 +648,604 @@ public:
     string name() override {
         return bank + " Bank percentage " + to_string((int)percent) + " off upto " + to_string((int) offCap);
     }
+
+    bool compile(CouponRule& rule, CouponSymbols& symbols) override {
+        rule.bankId = symbols.bankId(bank);
+        rule.minOriginalTotal = minSpend;
+        rule.strategy = discountStrategy;
+        return true;
+    }
+};
+
+
+//////////////////////////////////////////////////////////////////
+//                COUPON PROGRAM
+//////////////////////////////////////////////////////////////////
+
+// Everything the compiled rules look at, read off the cart's aggregates.
+struct CartSummary {
+    double originalTotal = 0.0;
+    double currentTotal = 0.0;
+    bool loyaltyMember = false;
+    int bankId = -1;
+    vector<pair<int, double>> categorySubtotals;   // (category ID, subtotal) for coupon categories in the cart
+
+    double subtotalOf(int categoryId) const {
+        for (const pair<int, double>& entry : categorySubtotals) {
+            if (entry.first == categoryId) return entry.second;
+        }
+        return -1.0;   // no item in that category
+    }
+};
+
+struct AppliedCoupon {
+    string name;
+    double discount;
+};
+
+struct PricingResult {
+    double originalTotal = 0.0;
+    double finalTotal = 0.0;
+    vector<AppliedCoupon> applied;   // in the order they were applied
+};
+
+// The registered coupons compiled into rules, filed by what gates them:
+// by category, by bank, loyalty-only, or by minimum spend (sorted). Pricing
+// a cart only visits the rules its summary can satisfy, then runs those in
+// registration order with the same semantics as the coupon chain: each
+// discount comes off the running total and a non-combinable coupon ends it.
+// Coupons that don't compile are asked directly, every time, against the
+// cart as given.
+class CouponProgram {
+private:
+    CouponSymbols symbols;
+    vector<CouponRule> rules;
+    vector<vector<int>> byCategory;          // category id -> rules
+    vector<vector<int>> byBank;              // bank id -> rules
+    vector<int> loyaltyOnly;
+    vector<pair<double, int>> byMinTotal;    // (minimum original total, rule), ascending
+    vector<int> customRules;
+
+    bool passes(const CouponRule& rule, const CartSummary& summary, const shared_ptr<Cart>& cart) const {
+        if (rule.custom) return cart && rule.custom->isApplicable(cart);
+        if (rule.categoryId >= 0 && summary.subtotalOf(rule.categoryId) < 0) return false;
+        if (rule.bankId >= 0 && rule.bankId != summary.bankId) return false;
+        if (rule.needsLoyalty && !summary.loyaltyMember) return false;
+        return summary.originalTotal >= rule.minOriginalTotal;
+    }
+
+    // Rules that might apply, in registration order. Only buckets the
+    // summary can match are opened.
+    vector<int> candidates(const CartSummary& summary) const {
+        vector<int> found = customRules;
+        for (const pair<int, double>& entry : summary.categorySubtotals) {
+            const vector<int>& bucket = byCategory[entry.first];   // summarize() kept only coupon categories
+            found.insert(found.end(), bucket.begin(), bucket.end());
+        }
+        if (summary.bankId >= 0) {
+            found.insert(found.end(), byBank[summary.bankId].begin(), byBank[summary.bankId].end());
+        }
+        if (summary.loyaltyMember) {
+            found.insert(found.end(), loyaltyOnly.begin(), loyaltyOnly.end());
+        }
+        for (const pair<double, int>& entry : byMinTotal) {
+            if (entry.first > summary.originalTotal) break;
+            found.push_back(entry.second);
+        }
+        sort(found.begin(), found.end());
+        return found;
+    }
+
+public:
+    CouponProgram() {}
+
+    explicit CouponProgram(const vector<shared_ptr<ICoupon>>& coupons) {
+        for (const shared_ptr<ICoupon>& coupon : coupons) {
+            CouponRule rule;
+            rule.position = (int)rules.size();
+            rule.name = coupon->name();
+            rule.combinable = coupon->isCombinable();
+            if (!coupon->compile(rule, symbols)) rule.custom = coupon;
+            rules.push_back(rule);
+        }
+        byCategory.resize(symbols.categoryCount());
+        byBank.resize(symbols.bankCount());
+        for (const CouponRule& rule : rules) {
+            if (rule.custom) customRules.push_back(rule.position);
+            else if (rule.categoryId >= 0) byCategory[rule.categoryId].push_back(rule.position);
+            else if (rule.bankId >= 0) byBank[rule.bankId].push_back(rule.position);
+            else if (rule.needsLoyalty) loyaltyOnly.push_back(rule.position);
+            else byMinTotal.push_back({rule.minOriginalTotal, rule.position});
+        }
+        sort(byMinTotal.begin(), byMinTotal.end());
+    }
+
+    size_t size() const {
+        return rules.size();
+    }
+
+    bool hasCustomRules() const {
+        return !customRules.empty();
+    }
+
+    CartSummary summarize(const Cart& cart) const {
+        CartSummary summary;
+        summary.originalTotal = cart.getOriginalTotal();
+        summary.currentTotal = cart.getCurrentTotal();
+        summary.loyaltyMember = cart.isLoyaltyMember();
+        summary.bankId = symbols.findBank(cart.getPaymentBank());
+        for (int categoryId : cart.getCategories()) {
+            if (categoryId >= (int)byCategory.size() || byCategory[categoryId].empty()) continue;
+            summary.categorySubtotals.push_back({categoryId, cart.getCategorySubtotal(categoryId)});
+        }
+        return summary;
+    }
+
+    CartSummary summarize(const shared_ptr<Cart>& cart) const {
+        return summarize(*cart);
+    }
+
+    // `cart` is only needed by coupons that didn't compile.
+    PricingResult price(const CartSummary& summary, const shared_ptr<Cart>& cart = nullptr) const {
+        PricingResult result;
+        result.originalTotal = summary.originalTotal;
+        double current = summary.currentTotal;
+        for (int position : candidates(summary)) {
+            const CouponRule& rule = rules[position];
+            if (!passes(rule, summary, cart)) continue;
+            double discount = discountAt(rule, summary, current, cart);
+            current = max(0.0, current - discount);
+            result.applied.push_back({rule.name, discount});
+            if (!rule.combinable) break;
+        }
+        result.finalTotal = current;
+        return result;
+    }
+
+    // Prices a cart without touching it. Coupons that didn't compile get a
+    // private copy, since they take the cart as mutable.
+    PricingResult price(const Cart& cart) const {
+        if (!hasCustomRules()) return price(summarize(cart));
+        shared_ptr<Cart> copy = make_shared<Cart>(cart);
+        return price(summarize(*copy), copy);
+    }
+
+    // Names of the coupons whose conditions the cart meets, in registration order.
+    vector<string> applicable(const CartSummary& summary, const shared_ptr<Cart>& cart = nullptr) const {
+        vector<string> names;
+        for (const CouponRule* rule : applicableRules(summary, cart)) {
+            names.push_back(rule->name);
+        }
+        return names;
+    }
+
+    vector<const CouponRule*> applicableRules(const CartSummary& summary, const shared_ptr<Cart>& cart = nullptr) const {
+        vector<const CouponRule*> found;
+        for (int position : candidates(summary)) {
+            if (passes(rules[position], summary, cart)) found.push_back(&rules[position]);
+        }
+        return found;
+    }
+
+    // What `rule` takes off when the running total is `current`. A coupon
+    // that didn't compile is asked on a copy of the cart brought down to
+    // `current`, unless the cart is already there.
+    double discountAt(const CouponRule& rule, const CartSummary& summary, double current, const shared_ptr<Cart>& cart) const {
+        if (!rule.custom) {
+            double base = rule.base == CouponRule::Base::CATEGORY_SUBTOTAL ? summary.subtotalOf(rule.categoryId) : current;
+            return rule.strategy->calculateDiscount(base);
+        }
+        if (cart->getCurrentTotal() == current) return rule.custom->getDiscount(cart);
+        shared_ptr<Cart> copy = make_shared<Cart>(*cart);
+        copy->applyDiscount(copy->getCurrentTotal() - current);
+        return rule.custom->getDiscount(copy);
+    }
 };
 
 
+//////////////////////////////////////////////////////////////////
+//                COUPON OPTIMIZER
+//////////////////////////////////////////////////////////////////
+
+struct CouponPlan {
+    PricingResult pricing;
+    bool optimal = false;   // false if the time budget ran out first
+};
+
+// Finds the order and subset of a cart's applicable coupons that leaves the
+// lowest total. A plan is any number of combinable coupons, each used at
+// most once, optionally ended by a single non-combinable one, which is the
+// same rule the coupon chain follows.
+//   - starts from the greedy plan (biggest discount next), so there is
+//     always an answer
+//   - flat and category-subtotal coupons take off the same amount whenever
+//     they're applied, and a percentage is never worth less for coming
+//     earlier, so every such coupon goes in, after the percentage ones.
+//     Only which percentage coupons to use, and in what order, is searched
+//     (coupons that didn't compile are searched as if they were percentages)
+//   - branch and bound over that: a branch is cut when even every
+//     remaining coupon at its current discount can't beat the best plan
+//   - (coupons used, running total) states already explored are skipped,
+//     so orders that reach the same point are searched once
+//   - plans proved optimal are cached by cart summary
+// If the budget runs out, the best plan found so far (at worst the greedy
+// one) is returned with `optimal` false. Carts with more than MAX_SEARCHED
+// applicable coupons get the greedy plan.
+class CouponOptimizer {
+private:
+    const CouponProgram& program;
+    mutable mutex cacheMtx;
+    mutable unordered_map<string, CouponPlan> cache;
+
+    struct Search {
+        const CartSummary& summary;
+        const shared_ptr<Cart>& cart;
+        vector<const CouponRule*> rules;
+        vector<int> scaling;     // combinable, discount depends on the running total
+        vector<int> fixed;       // combinable, same discount at any point
+        vector<int> exclusive;   // non-combinable
+        double fixedTotal = 0;
+        chrono::steady_clock::time_point deadline;
+        set<pair<uint64_t, long long>> seen;   // (coupons used, running total in 1/10000 Rs)
+        vector<int> path;
+        vector<int> bestPath;
+        double bestTotal;
+        long long nodes = 0;
+        bool timedOut = false;
+
+        Search(const CartSummary& summary, const shared_ptr<Cart>& cart) : summary(summary), cart(cart) {}
+    };
+
+    double discountAt(Search& search, int index, double current) const {
+        return program.discountAt(*search.rules[index], search.summary, current, search.cart);
+    }
+
+    // Read off the compiled rule, never the strategy's type: pruning and
+    // the order of fixed coupons are only sound if this is right.
+    static bool isFixed(const CouponRule& rule) {
+        if (rule.custom) return false;
+        return rule.base == CouponRule::Base::CATEGORY_SUBTOTAL || rule.fixedAmount;
+    }
+
+    void classify(Search& search) const {
+        for (int i = 0; i < (int)search.rules.size(); i++) {
+            const CouponRule& rule = *search.rules[i];
+            if (!rule.combinable) {
+                search.exclusive.push_back(i);
+            } else if (isFixed(rule)) {
+                double discount = discountAt(search, i, search.summary.currentTotal);
+                if (discount <= 0) continue;
+                search.fixed.push_back(i);
+                search.fixedTotal += discount;
+            } else {
+                search.scaling.push_back(i);
+            }
+        }
+    }
+
+    // Ends the plan at `current`: all fixed coupons, then optionally one
+    // non-combinable.
+    void finish(Search& search, double current) const {
+        double withoutEnding = max(0.0, current - search.fixedTotal);
+        double total = withoutEnding;
+        int ending = -1;
+        for (int i : search.exclusive) {
+            double withEnding = max(0.0, withoutEnding - discountAt(search, i, withoutEnding));
+            if (withEnding < total) { total = withEnding; ending = i; }
+        }
+        if (total >= search.bestTotal) return;
+        search.bestTotal = total;
+        search.bestPath = search.path;
+        search.bestPath.insert(search.bestPath.end(), search.fixed.begin(), search.fixed.end());
+        if (ending >= 0) search.bestPath.push_back(ending);
+    }
+
+    void greedy(Search& search) const {
+        double current = search.summary.currentTotal;
+        vector<bool> used(search.rules.size(), false);
+        while (true) {
+            int pick = -1;
+            double pickDiscount = 0;
+            for (int i = 0; i < (int)search.rules.size(); i++) {
+                if (used[i] || !search.rules[i]->combinable) continue;
+                double discount = discountAt(search, i, current);
+                if (discount > pickDiscount) { pick = i; pickDiscount = discount; }
+            }
+            if (pick < 0) break;
+            used[pick] = true;
+            search.path.push_back(pick);
+            current = max(0.0, current - pickDiscount);
+        }
+        search.bestPath = search.path;
+        search.bestTotal = current;
+        for (int i = 0; i < (int)search.rules.size(); i++) {
+            if (search.rules[i]->combinable) continue;
+            double total = max(0.0, current - discountAt(search, i, current));
+            if (total < search.bestTotal) {
+                search.bestTotal = total;
+                search.bestPath = search.path;
+                search.bestPath.push_back(i);
+            }
+        }
+        search.path.clear();
+    }
+
+    void explore(Search& search, uint64_t used, double current) const {
+        finish(search, current);
+        if (search.timedOut || current <= 0) return;
+        if (++search.nodes % 32 == 0 && chrono::steady_clock::now() > search.deadline) {
+            search.timedOut = true;
+            return;
+        }
+        if (!search.seen.insert({used, llround(current * 10000)}).second) return;
+
+        // Discounts never grow as the total falls, so every unused coupon at
+        // its discount right now, plus the fixed ones and the best
+        // non-combinable one, bounds what the rest of the plan can do.
+        // Coupons that didn't compile promise no such thing.
+        vector<pair<double, int>> next;
+        double bound = search.fixedTotal;
+        bool unbounded = false;
+        for (int i : search.scaling) {
+            if (used >> i & 1) continue;
+            double discount = discountAt(search, i, current);
+            if (search.rules[i]->custom) unbounded = true;
+            if (discount <= 0) continue;
+            next.push_back({discount, i});
+            bound += discount;
+        }
+        double bestExclusive = 0;
+        for (int i : search.exclusive) {
+            if (search.rules[i]->custom) unbounded = true;
+            bestExclusive = max(bestExclusive, discountAt(search, i, current));
+        }
+        if (!unbounded && current - bound - bestExclusive >= search.bestTotal) return;
+
+        sort(next.rbegin(), next.rend());
+        for (const pair<double, int>& option : next) {
+            search.path.push_back(option.second);
+            explore(search, used | (1ULL << option.second), max(0.0, current - option.first));
+            search.path.pop_back();
+            if (search.timedOut) return;
+        }
+    }
+
+    static string keyOf(const CartSummary& summary) {
+        string key;
+        auto append = [&key](const void* data, size_t size) { key.append((const char*)data, size); };
+        append(&summary.originalTotal, sizeof(double));
+        append(&summary.currentTotal, sizeof(double));
+        append(&summary.loyaltyMember, sizeof(bool));
+        append(&summary.bankId, sizeof(int));
+        vector<pair<int, double>> categories = summary.categorySubtotals;
+        sort(categories.begin(), categories.end());
+        for (const pair<int, double>& entry : categories) {
+            append(&entry.first, sizeof(int));
+            append(&entry.second, sizeof(double));
+        }
+        return key;
+    }
+
+public:
+    static const int MAX_SEARCHED = 64;
+    static const size_t CACHE_LIMIT = 100000;
+
+    explicit CouponOptimizer(const CouponProgram& program) : program(program) {}
+
+    CouponPlan bestPlan(const shared_ptr<Cart>& cart, chrono::microseconds budget) const {
+        CartSummary summary = program.summarize(cart);
+        // Coupons that didn't compile may look at more of the cart than the summary.
+        bool cacheable = !program.hasCustomRules();
+        string key = cacheable ? keyOf(summary) : "";
+        if (cacheable) {
+            lock_guard<mutex> lock(cacheMtx);
+            auto it = cache.find(key);
+            if (it != cache.end()) return it->second;
+        }
+
+        Search search(summary, cart);
+        search.rules = program.applicableRules(summary, cart);
+        search.deadline = chrono::steady_clock::now() + budget;
+        greedy(search);
+        classify(search);
+        bool searched = search.rules.size() <= (size_t)MAX_SEARCHED;
+        if (searched) explore(search, 0, summary.currentTotal);
+
+        CouponPlan plan;
+        plan.optimal = searched && !search.timedOut;
+        plan.pricing.originalTotal = summary.originalTotal;
+        double current = summary.currentTotal;
+        for (int index : search.bestPath) {
+            double discount = discountAt(search, index, current);
+            current = max(0.0, current - discount);
+            plan.pricing.applied.push_back({search.rules[index]->name, discount});
+        }
+        plan.pricing.finalTotal = current;
+
+        if (cacheable && plan.optimal) {
+            lock_guard<mutex> lock(cacheMtx);
+            if (cache.size() >= CACHE_LIMIT) cache.clear();
+            cache.emplace(key, plan);
+        }
+        return plan;
+    }
+};
+
+
+//////////////////////////////////////////////////////////////////
+//                WORK-STEALING POOL
+//////////////////////////////////////////////////////////////////
+
+// Each worker owns a deque: it pushes/pops its own work at the back and,
+// when empty, steals from the front of the others'.
+class WorkStealingPool {
+private:
+    struct WorkerQueue {
+        mutex mtx;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> workers;
+    atomic<unsigned> nextQueue;
+    atomic<long long> queued;        // sitting in some deque
+    atomic<long long> outstanding;   // submitted and not yet finished
+    atomic<int> sleeping;
+    bool stopping;
+    mutex idleMtx;
+    condition_variable workAvailable;
+    condition_variable allDone;
+
+    static thread_local WorkStealingPool* currentPool;
+    static thread_local int currentWorker;
+
+    bool tryPop(int self, function<void()>& task) {
+        int count = (int)queues.size();
+        for (int i = 0; i < count; i++) {
+            WorkerQueue& queue = *queues[(self + i) % count];
+            lock_guard<mutex> lock(queue.mtx);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                task = move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void run(int self) {
+        currentPool = this;
+        currentWorker = self;
+        while (true) {
+            function<void()> task;
+            if (tryPop(self, task)) {
+                task();
+                if (--outstanding == 0) {
+                    lock_guard<mutex> lock(idleMtx);
+                    allDone.notify_all();
+                }
+                continue;
+            }
+            unique_lock<mutex> lock(idleMtx);
+            sleeping++;
+            workAvailable.wait(lock, [this]() { return stopping || queued > 0; });
+            sleeping--;
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+    }
+
+public:
+    WorkStealingPool(int threadCount = (int)max(1u, thread::hardware_concurrency())) {
+        nextQueue = 0;
+        queued = 0;
+        outstanding = 0;
+        sleeping = 0;
+        stopping = false;
+        for (int i = 0; i < threadCount; i++) {
+            queues.push_back(make_unique<WorkerQueue>());
+        }
+        for (int i = 0; i < threadCount; i++) {
+            workers.emplace_back(&WorkStealingPool::run, this, i);
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> lock(idleMtx);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    int getThreadCount() const {
+        return (int)workers.size();
+    }
+
+    // From a worker the task goes on that worker's own deque (it's likely
+    // follow-up work on data already in cache); otherwise round-robin.
+    void submit(function<void()> task) {
+        int target = (currentPool == this) ? currentWorker
+                                           : (int)(nextQueue++ % queues.size());
+        outstanding++;
+        {
+            lock_guard<mutex> lock(queues[target]->mtx);
+            queues[target]->tasks.push_back(move(task));
+        }
+        queued++;
+        if (sleeping > 0) {
+            lock_guard<mutex> lock(idleMtx);
+            workAvailable.notify_one();
+        }
+    }
+
+    void waitIdle() {
+        unique_lock<mutex> lock(idleMtx);
+        allDone.wait(lock, [this]() { return outstanding == 0; });
+    }
+};
+
+thread_local WorkStealingPool* WorkStealingPool::currentPool = nullptr;
+thread_local int WorkStealingPool::currentWorker = -1;
+
+
 //////////////////////////////////////////////////////////////////
 //                COUPON MANAGER
 //////////////////////////////////////////////////////////////////
 
+// One published version of the coupon set. Never changed once published;
+// a registration or removal builds the next one. The optimizer refers to
+// the snapshot's own program, so a snapshot is never copied or moved: it
+// only lives behind the published shared_ptr.
+struct CouponSnapshot {
+    uint64_t version = 0;
+    vector<shared_ptr<ICoupon>> coupons;   // registration order
+    CouponProgram program;
+    CouponOptimizer optimizer{program};
+
+    CouponSnapshot() {}
+    CouponSnapshot(uint64_t version, vector<shared_ptr<ICoupon>> coupons)
+        : version(version), coupons(move(coupons)), program(this->coupons) {}
+    CouponSnapshot(const CouponSnapshot&) = delete;
+    CouponSnapshot(CouponSnapshot&&) = delete;
+    CouponSnapshot& operator=(const CouponSnapshot&) = delete;
+    CouponSnapshot& operator=(CouponSnapshot&&) = delete;
+};
+
+// Checkouts take the current snapshot with an atomic load and price against
+// it with no lock held; a snapshot stays alive for as long as some
+// checkout still holds it. Writers serialize among themselves, compile the
+// next snapshot off to the side and swap it in.
 class CouponManager {
 private:
     static CouponManager *instance;
-    shared_ptr<ICoupon> head;
-    mutable mutex mtx;
+    shared_ptr<const CouponSnapshot> current;
+    mutex writeMtx;                        // registrations and removals only
+    mutable once_flag poolStarted;
+    mutable unique_ptr<WorkStealingPool> pool;   // batch pricing, started on first use
     CouponManager() {
-        head = nullptr;
+        current = make_shared<const CouponSnapshot>();
+    }
+
+    void publish(vector<shared_ptr<ICoupon>> coupons) {
+        uint64_t version = snapshot()->version + 1;
+        atomic_store(&current, shared_ptr<const CouponSnapshot>(make_shared<CouponSnapshot>(version, move(coupons))));
     }
+
 public:
+    static const int BATCH_CHUNK = 256;   // carts per pool task
+
     static CouponManager* getInstance() {
         if (!instance) {
             instance = new CouponManager();
@@ -448,36 +1253,94 @@ public:
         return instance;
     }
 
+    shared_ptr<const CouponSnapshot> snapshot() const {
+        return atomic_load(&current);
+    }
+
+    uint64_t getVersion() const {
+        return snapshot()->version;
+    }
+
     void registerCoupon(shared_ptr<ICoupon> coupon) {
-        lock_guard<mutex> lock(mtx);
-        if (!head) {
-            head = coupon;
-        } else {
-            shared_ptr<ICoupon> cur = head;
-            while (cur->getNext()) {
-                cur = cur->getNext();
-            }
-            cur->setNext(coupon);
-        }
+        lock_guard<mutex> lock(writeMtx);
+        vector<shared_ptr<ICoupon>> coupons = snapshot()->coupons;
+        coupons.push_back(coupon);
+        publish(move(coupons));
+    }
+
+    // False if the coupon isn't registered.
+    bool removeCoupon(const shared_ptr<ICoupon>& coupon) {
+        lock_guard<mutex> lock(writeMtx);
+        vector<shared_ptr<ICoupon>> coupons = snapshot()->coupons;
+        auto it = find(coupons.begin(), coupons.end(), coupon);
+        if (it == coupons.end()) return false;
+        coupons.erase(it);
+        publish(move(coupons));
+        return true;
     }
 
     vector<string> getApplicable(shared_ptr<Cart> cart) const {
-        lock_guard<mutex> lock(mtx);
-        vector<string> res;
-        shared_ptr<ICoupon> cur = head;
-        while (cur) {
-            if (cur->isApplicable(cart)) {
-                res.push_back(cur->name());
+        shared_ptr<const CouponSnapshot> coupons = snapshot();
+        return coupons->program.applicable(coupons->program.summarize(cart), cart);
+    }
+
+    // Prices every cart against one snapshot without changing any of them;
+    // results[i] is the breakdown for carts[i]. Batches larger than a chunk
+    // are split across the pool, and each task writes only its own slice of
+    // the results.
+    vector<PricingResult> priceAll(const vector<shared_ptr<const Cart>>& carts) const {
+        shared_ptr<const CouponSnapshot> coupons = snapshot();
+        vector<PricingResult> results(carts.size());
+        auto priceRange = [&coupons, &carts, &results](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                results[i] = coupons->program.price(*carts[i]);
+            }
+        };
+        if (carts.size() <= (size_t)BATCH_CHUNK) {
+            priceRange(0, carts.size());
+            return results;
+        }
+
+        call_once(poolStarted, [this]() { pool = make_unique<WorkStealingPool>(); });
+        // The tasks point into this frame, so every submitted chunk has to
+        // finish before an error, from a chunk or from submitting, leaves it.
+        vector<future<void>> chunks;
+        exception_ptr submitError;
+        try {
+            for (size_t begin = 0; begin < carts.size(); begin += BATCH_CHUNK) {
+                size_t end = min(carts.size(), begin + BATCH_CHUNK);
+                shared_ptr<promise<void>> done = make_shared<promise<void>>();
+                chunks.push_back(done->get_future());
+                pool->submit([priceRange, begin, end, done]() {
+                    try {
+                        priceRange(begin, end);
+                        done->set_value();
+                    } catch (...) {
+                        done->set_exception(current_exception());
+                    }
+                });
             }
-            cur = cur->getNext();
+        } catch (...) {
+            submitError = current_exception();
         }
-        return res;
+        for (future<void>& chunk : chunks) chunk.wait();
+        if (submitError) rethrow_exception(submitError);
+        for (future<void>& chunk : chunks) chunk.get();
+        return results;
+    }
+
+    // The best legal combination of the cart's coupons, searched for at most
+    // `budget`. The cart isn't changed.
+    CouponPlan bestPlan(shared_ptr<Cart> cart, chrono::microseconds budget = chrono::microseconds(2000)) const {
+        return snapshot()->optimizer.bestPlan(cart, budget);
     }
 
     double applyAll(shared_ptr<Cart> cart) {
-        lock_guard<mutex> lock(mtx);
-        if (head) {
-            head->applyDiscount(cart);
+        shared_ptr<const CouponSnapshot> coupons = snapshot();
+        PricingResult result = coupons->program.price(coupons->program.summarize(cart), cart);
+        for (AppliedCoupon& coupon : result.applied) {
+            cart->applyDiscount(coupon.discount);
+            cout << coupon.name << " applied: " << coupon.discount << endl;
         }
         return cart->getCurrentTotal();
     }
@@ -486,11 +1349,265 @@ public:
 CouponManager* CouponManager::instance = nullptr;
 
 
+//////////////////////////////////////////////////////////////////
+//                BENCHMARKS
+//////////////////////////////////////////////////////////////////
+
+// Pricing one cart with more and more registered coupons, only four of
+// which ever apply to it: the coupon chain walk against the compiled program.
+void runPricingScaleBenchmark(int cartsPerRun) {
+    vector<shared_ptr<Product>> products = {
+        make_shared<Product>("Winter Jacket", "Clothing", 1000.0),
+        make_shared<Product>("Smartphone", "Electronics", 20000.0),
+        make_shared<Product>("Jeans", "Clothing", 1000.0),
+        make_shared<Product>("Headphones", "Electronics", 2000.0)
+    };
+    shared_ptr<Cart> cart = make_shared<Cart>();
+    for (size_t i = 0; i < products.size(); i++) cart->addProduct(products[i], 1 + i % 2);
+    cart->setLoyaltyMember(true);
+    cart->setPaymentBank("ABC");
+
+    cout << "Pricing one cart, " << cartsPerRun << " times per run\n";
+    for (int couponCount : {4, 64, 1024, 16384}) {
+        vector<shared_ptr<ICoupon>> coupons = {
+            make_shared<SeasonalCoupon>("Clothing", 10), make_shared<LoyaltyDiscount>(5),
+            make_shared<BulkPurchaseDiscount>(1000, 100), make_shared<BankingCoupon>("ABC", 2000, 15, 500)
+        };
+        for (int i = (int)coupons.size(); i < couponCount; i++) {
+            if (i % 3 == 0) coupons.push_back(make_shared<SeasonalCoupon>("Category" + to_string(i), 10));
+            else if (i % 3 == 1) coupons.push_back(make_shared<BankingCoupon>("Bank" + to_string(i), 500, 10, 200));
+            else coupons.push_back(make_shared<BulkPurchaseDiscount>(1e9 + i, 50));
+        }
+        for (size_t i = 0; i + 1 < coupons.size(); i++) coupons[i]->setNext(coupons[i + 1]);
+        CouponProgram program(coupons);
+
+        double chainTotal = 0, programTotal = 0;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < cartsPerRun; i++) {
+            shared_ptr<Cart> copy = make_shared<Cart>(*cart);
+            for (shared_ptr<ICoupon> coupon = coupons[0]; coupon; coupon = coupon->getNext()) {
+                if (!coupon->isApplicable(copy)) continue;
+                copy->applyDiscount(coupon->getDiscount(copy));
+                if (!coupon->isCombinable()) break;
+            }
+            chainTotal += copy->getCurrentTotal();
+        }
+        double chainUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / cartsPerRun;
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < cartsPerRun; i++) {
+            programTotal += program.price(program.summarize(cart), cart).finalTotal;
+        }
+        double programUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / cartsPerRun;
+        cout << "  " << setw(5) << couponCount << " coupons: chain " << fixed << setprecision(3) << chainUs
+             << " us, program " << programUs << " us" << (chainTotal == programTotal ? "" : " (TOTALS DIFFER!)") << "\n";
+        cout.unsetf(ios::fixed);
+    }
+}
+
+
+// Checkout threads pricing their own carts while a writer keeps registering
+// and removing a coupon: every price behind one mutex (the old manager)
+// against lock-free reads of the published snapshot.
+void runConcurrentPricingBenchmark(int cartsPerThread) {
+    CouponManager* mgr = CouponManager::getInstance();
+    mgr->registerCoupon(make_shared<SeasonalCoupon>("Clothing", 10));
+    mgr->registerCoupon(make_shared<LoyaltyDiscount>(5));
+    mgr->registerCoupon(make_shared<BulkPurchaseDiscount>(1000, 100));
+    mgr->registerCoupon(make_shared<BankingCoupon>("ABC", 2000, 15, 500));
+    for (int i = 0; i < 256; i++) mgr->registerCoupon(make_shared<SeasonalCoupon>("Category" + to_string(i), 10));
+
+    shared_ptr<Cart> cart = make_shared<Cart>();
+    cart->addProduct(make_shared<Product>("Winter Jacket", "Clothing", 1000.0), 1);
+    cart->addProduct(make_shared<Product>("Smartphone", "Electronics", 20000.0), 1);
+    cart->addProduct(make_shared<Product>("Jeans", "Clothing", 1000.0), 2);
+    cart->setLoyaltyMember(true);
+    cart->setPaymentBank("ABC");
+
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    cout << "Pricing " << cartsPerThread << " carts per thread (" << cores << " cores)\n";
+    for (int threads : {1, 2, 4, 8}) {
+        for (bool locked : {true, false}) {
+            mutex pricingMtx;
+            atomic<bool> done{false};
+            atomic<long long> priced{0};
+            uint64_t versionBefore = mgr->getVersion();
+            thread writer([&]() {
+                shared_ptr<ICoupon> flash = make_shared<BulkPurchaseDiscount>(1e9, 50);
+                while (!done.load()) {
+                    mgr->registerCoupon(flash);
+                    mgr->removeCoupon(flash);
+                    this_thread::sleep_for(chrono::milliseconds(1));
+                }
+            });
+
+            auto start = chrono::steady_clock::now();
+            vector<thread> workers;
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&]() {
+                    shared_ptr<Cart> mine = make_shared<Cart>(*cart);
+                    long long count = 0;
+                    for (int i = 0; i < cartsPerThread; i++) {
+                        shared_ptr<const CouponSnapshot> coupons = mgr->snapshot();
+                        if (locked) {
+                            lock_guard<mutex> lock(pricingMtx);
+                            coupons->program.price(coupons->program.summarize(mine), mine);
+                        } else {
+                            coupons->program.price(coupons->program.summarize(mine), mine);
+                        }
+                        count++;
+                    }
+                    priced += count;
+                });
+            }
+            for (thread& worker : workers) worker.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            done = true;
+            writer.join();
+
+            cout << "  " << threads << " threads, " << (locked ? "mutex   " : "snapshot") << ": "
+                 << (long long)(priced.load() / seconds) << " carts/s, "
+                 << (mgr->getVersion() - versionBefore) / 2 << " coupon swaps\n";
+        }
+    }
+}
+
+
+// Price previews for a page of random carts: one at a time on this thread
+// against CouponManager::priceAll.
+void runBatchPricingBenchmark(int cartCount) {
+    CouponManager* mgr = CouponManager::getInstance();
+    mgr->registerCoupon(make_shared<SeasonalCoupon>("Clothing", 10));
+    mgr->registerCoupon(make_shared<LoyaltyDiscount>(5));
+    mgr->registerCoupon(make_shared<BulkPurchaseDiscount>(1000, 100));
+    mgr->registerCoupon(make_shared<BankingCoupon>("ABC", 2000, 15, 500));
+    for (int i = 0; i < 256; i++) mgr->registerCoupon(make_shared<SeasonalCoupon>("Category" + to_string(i), 10));
+
+    vector<string> categories = {"Clothing", "Electronics", "Grocery", "Category7", "Category42"};
+    vector<shared_ptr<Product>> products;
+    for (int i = 0; i < 200; i++) {
+        products.push_back(make_shared<Product>("Product" + to_string(i), categories[i % categories.size()], 50.0 + (i * 37) % 5000));
+    }
+    mt19937 rng(49);
+    vector<shared_ptr<const Cart>> carts;
+    for (int i = 0; i < cartCount; i++) {
+        shared_ptr<Cart> cart = make_shared<Cart>();
+        for (int j = 0, items = 1 + rng() % 8; j < items; j++) cart->addProduct(products[rng() % products.size()], 1 + rng() % 3);
+        cart->setLoyaltyMember(rng() % 2);
+        cart->setPaymentBank(rng() % 3 == 0 ? "ABC" : "XYZ");
+        carts.push_back(cart);
+    }
+
+    shared_ptr<const CouponSnapshot> coupons = mgr->snapshot();
+    auto start = chrono::steady_clock::now();
+    vector<PricingResult> one;
+    for (const shared_ptr<const Cart>& cart : carts) one.push_back(coupons->program.price(*cart));
+    double oneSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    mgr->priceAll(carts);   // start the pool outside the timing
+    start = chrono::steady_clock::now();
+    vector<PricingResult> batch = mgr->priceAll(carts);
+    double batchSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int mismatched = 0;
+    for (size_t i = 0; i < carts.size(); i++) {
+        if (one[i].finalTotal != batch[i].finalTotal || one[i].applied.size() != batch[i].applied.size()) mismatched++;
+    }
+    cout << "Pricing " << cartCount << " carts (" << max(1u, thread::hardware_concurrency()) << " cores)\n"
+         << "  one by one: " << (long long)(cartCount / oneSeconds) << " carts/s\n"
+         << "  priceAll:   " << (long long)(cartCount / batchSeconds) << " carts/s, "
+         << mismatched << " mismatched\n";
+}
+
+
+// Random carts against a coupon set where order matters (percentages,
+// flats, caps) and one deal that can't be combined: what the registration
+// order gives against the best plan, and what a plan costs to find.
+void runOptimizerBenchmark(int cartCount) {
+    // A bank deal that replaces every other coupon rather than stacking.
+    class ExclusiveBankDeal : public BankingCoupon {
+    public:
+        ExclusiveBankDeal(const string& bank, double minSpend, double percent, double offCap)
+            : BankingCoupon(bank, minSpend, percent, offCap) {}
+        bool isCombinable() override {
+            return false;
+        }
+    };
+
+    CouponManager* mgr = CouponManager::getInstance();
+    mgr->registerCoupon(make_shared<BulkPurchaseDiscount>(1000, 100));
+    mgr->registerCoupon(make_shared<BulkPurchaseDiscount>(5000, 400));
+    mgr->registerCoupon(make_shared<SeasonalCoupon>("Clothing", 10));
+    mgr->registerCoupon(make_shared<LoyaltyDiscount>(5));
+    mgr->registerCoupon(make_shared<BankingCoupon>("ABC", 2000, 15, 500));
+    mgr->registerCoupon(make_shared<LoyaltyDiscount>(12));
+    mgr->registerCoupon(make_shared<ExclusiveBankDeal>("ABC", 3000, 30, 3000));
+    mgr->registerCoupon(make_shared<SeasonalCoupon>("Electronics", 8));
+    mgr->registerCoupon(make_shared<BankingCoupon>("XYZ", 1000, 10, 300));
+
+    vector<string> categories = {"Clothing", "Electronics", "Grocery"};
+    vector<shared_ptr<Product>> products;
+    for (int i = 0; i < 100; i++) {
+        products.push_back(make_shared<Product>("Product" + to_string(i), categories[i % categories.size()], 50.0 + (i * 53) % 4000));
+    }
+    mt19937 rng(50);
+    vector<shared_ptr<Cart>> carts;
+    for (int i = 0; i < cartCount; i++) {
+        shared_ptr<Cart> cart = make_shared<Cart>();
+        for (int j = 0, items = 1 + rng() % 6; j < items; j++) cart->addProduct(products[rng() % products.size()], 1 + rng() % 2);
+        cart->setLoyaltyMember(rng() % 2);
+        cart->setPaymentBank(rng() % 2 ? "ABC" : "XYZ");
+        carts.push_back(cart);
+    }
+
+    shared_ptr<const CouponSnapshot> coupons = mgr->snapshot();
+    double chainTotal = 0, bestTotal = 0;
+    int improved = 0, unproved = 0;
+    auto start = chrono::steady_clock::now();
+    for (const shared_ptr<Cart>& cart : carts) {
+        CouponPlan plan = mgr->bestPlan(cart);
+        bestTotal += plan.pricing.finalTotal;
+        double chain = coupons->program.price(*cart).finalTotal;
+        chainTotal += chain;
+        if (plan.pricing.finalTotal < chain - 1e-9) improved++;
+        if (!plan.optimal) unproved++;
+    }
+    double searchUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / cartCount;
+    start = chrono::steady_clock::now();
+    for (const shared_ptr<Cart>& cart : carts) mgr->bestPlan(cart);
+    double cachedUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / cartCount;
+
+    cout << fixed << setprecision(2)
+         << "Best coupon plan for " << cartCount << " carts\n"
+         << "  registration order: Rs " << chainTotal / cartCount << " per cart\n"
+         << "  best plan:          Rs " << bestTotal / cartCount << " per cart, cheaper for "
+         << improved << " carts, " << unproved << " ran out of time\n"
+         << "  search " << searchUs << " us per cart, " << cachedUs << " us from the cache\n";
+    cout.unsetf(ios::fixed);
+}
+
+
 //////////////////////////////////////////////////////////////////
 //                MAIN / CLIENT
 //////////////////////////////////////////////////////////////////
 
-int main(){
+int main(int argc, char* argv[]){
+    if (argc >= 2 && string(argv[1]) == "--bench-pricing") {
+        runPricingScaleBenchmark(argc >= 3 ? stoi(argv[2]) : 2000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-concurrent") {
+        runConcurrentPricingBenchmark(argc >= 3 ? stoi(argv[2]) : 200000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-batch") {
+        runBatchPricingBenchmark(argc >= 3 ? stoi(argv[2]) : 100000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-optimizer") {
+        runOptimizerBenchmark(argc >= 3 ? stoi(argv[2]) : 20000);
+        return 0;
+    }
+
     CouponManager *mgr = CouponManager::getInstance();
 
     // shared_ptr<CouponManager> mgr = CouponManager::getInstance(); NOT WORKING FOR SINGLETON
@@ -524,6 +1641,14 @@ int main(){
     
      cout << endl;
 
+    CouponPlan best = mgr->bestPlan(cart);
+    cout << "Best coupon plan" << (best.optimal ? "" : " (search ran out of time)") << ":" << endl;
+    for (AppliedCoupon& coupon : best.pricing.applied) {
+        cout << " - " << coupon.name << ": " << coupon.discount << endl;
+    }
+    cout << "Cart Total with best plan: " << best.pricing.finalTotal << " Rs" << endl;
+    cout << endl;
+
     double finalTotal = mgr->applyAll(cart);
     cout << "Final Cart Total after discounts: " << finalTotal << " Rs" << endl;
     cout << endl;
@@ -28,6 +28,11 @@ DESIGN PATTERNS USED
 
 #include <bits/stdc++.h>
 // #include "../../../builtin_files/bits-stdc++.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 using namespace std;
 
 /////////////////////////////////////////////////
@@ -43,7 +48,8 @@ enum class DeviceType {
 enum class PlayStrategyType { 
     SEQUENTIAL, 
     RANDOM, 
-    CUSTOM_QUEUE 
+    CUSTOM_QUEUE,
+    SMART_SHUFFLE
 };
 
 
@@ -56,11 +62,13 @@ private:
     string title;
     string artist;
     string filePath;
+    int rating;   // 1-5 stars, 0 = not rated
 public:
     Song(string t, string a, string f) {
         title = t;
         artist = a;
         filePath = f;
+        rating = 0;
     }
     string getTitle() { 
         return title; 
@@ -71,6 +79,224 @@ public:
     string getFilePath() { 
         return filePath;  
     }
+    int getRating() {
+        return rating;
+    }
+    void setRating(int stars) {
+        if (stars < 0 || stars > 5) {
+            throw runtime_error("Rating must be between 0 and 5 stars.");
+        }
+        rating = stars;
+    }
+};
+
+
+/////////////////////////////////////////////////
+//          AUDIO FRAMES
+////////////////////////////////////////////////
+
+// One decoded PCM buffer. Read-only once produced, so it can be shared freely
+// (e.g. by every connected output device) without copying.
+using AudioFrame = vector<int16_t>;
+using FrameBuffer = shared_ptr<const AudioFrame>;
+
+static constexpr int SAMPLE_RATE_HZ = 44100;
+
+
+/////////////////////////////////////////////////
+//          PLAYBACK TELEMETRY
+////////////////////////////////////////////////
+
+struct HistogramSummary {
+    uint64_t count;
+    double mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+// Log2-bucketed histogram. Recording is a few relaxed atomic adds, so it is
+// safe (and cheap) from any thread. Percentiles are bucket upper bounds.
+class LatencyHistogram {
+private:
+    static constexpr int BUCKETS = 64;
+    atomic<uint64_t> buckets[BUCKETS];
+    atomic<uint64_t> count;
+    atomic<uint64_t> sum;
+    atomic<uint64_t> maxValue;
+
+    static int bucketOf(uint64_t value) {
+        int bucket = 0;
+        while (value > 0 && bucket < BUCKETS - 1) {
+            value >>= 1;
+            bucket++;
+        }
+        return bucket;   // bucket b holds [2^(b-1), 2^b)
+    }
+
+public:
+    LatencyHistogram() {
+        for (atomic<uint64_t>& bucket : buckets) {
+            bucket = 0;
+        }
+        count = 0;
+        sum = 0;
+        maxValue = 0;
+    }
+
+    void record(uint64_t value) {
+        buckets[bucketOf(value)].fetch_add(1, memory_order_relaxed);
+        count.fetch_add(1, memory_order_relaxed);
+        sum.fetch_add(value, memory_order_relaxed);
+        uint64_t seen = maxValue.load(memory_order_relaxed);
+        while (value > seen && !maxValue.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+        }
+    }
+
+    HistogramSummary summarize() const {
+        HistogramSummary summary = {0, 0.0, 0, 0, 0, 0};
+        uint64_t snapshot[BUCKETS];
+        for (int b = 0; b < BUCKETS; b++) {
+            snapshot[b] = buckets[b].load(memory_order_relaxed);
+            summary.count += snapshot[b];
+        }
+        summary.max = maxValue.load(memory_order_relaxed);
+        if (summary.count == 0) {
+            return summary;
+        }
+        summary.mean = (double)sum.load(memory_order_relaxed) / count.load(memory_order_relaxed);
+        auto percentile = [&](double fraction) {
+            uint64_t rank = (uint64_t)ceil(fraction * summary.count);
+            uint64_t seen = 0;
+            for (int b = 0; b < BUCKETS; b++) {
+                seen += snapshot[b];
+                if (seen >= rank) {
+                    uint64_t upper = (b == 0) ? 0 : (b >= 63 ? UINT64_MAX : (1ull << b) - 1);
+                    return min(upper, summary.max);
+                }
+            }
+            return summary.max;
+        };
+        summary.p50 = percentile(0.50);
+        summary.p90 = percentile(0.90);
+        summary.p99 = percentile(0.99);
+        return summary;
+    }
+};
+
+struct TelemetrySnapshot {
+    HistogramSummary timeToFirstSampleUs;
+    HistogramSummary transitionGapUs;
+    HistogramSummary decodeSamplesPerSecond;
+    HistogramSummary bufferFillPercent;
+    uint64_t underruns;
+    uint64_t droppedFrames;
+};
+
+// Playback metrics for one listener (the local player, or one PlayerSession).
+class PlaybackTelemetry {
+private:
+    LatencyHistogram timeToFirstSample;
+    LatencyHistogram transitionGap;
+    LatencyHistogram decodeThroughput;
+    LatencyHistogram bufferFill;
+    atomic<uint64_t> underruns;
+    atomic<uint64_t> droppedFrames;
+
+    static void printRow(ostream& out, const string& name, const HistogramSummary& h, const string& unit) {
+        out << "  " << left << setw(22) << name << right
+            << " n=" << h.count << " mean=" << (uint64_t)h.mean << " p50=" << h.p50
+            << " p90=" << h.p90 << " p99=" << h.p99 << " max=" << h.max << " " << unit << "\n";
+    }
+
+public:
+    PlaybackTelemetry() {
+        underruns = 0;
+        droppedFrames = 0;
+    }
+
+    void recordTimeToFirstSample(chrono::steady_clock::duration elapsed) {
+        timeToFirstSample.record(chrono::duration_cast<chrono::microseconds>(elapsed).count());
+    }
+    void recordTransitionGap(chrono::steady_clock::duration gap) {
+        transitionGap.record(chrono::duration_cast<chrono::microseconds>(gap).count());
+    }
+    // A decode too short for the clock to see has no meaningful rate.
+    void recordDecode(uint64_t samples, chrono::steady_clock::duration elapsed) {
+        if (elapsed <= chrono::steady_clock::duration::zero()) {
+            return;
+        }
+        decodeThroughput.record((uint64_t)(samples / chrono::duration<double>(elapsed).count()));
+    }
+    void recordBufferFill(size_t queued, size_t capacity) {
+        bufferFill.record(capacity == 0 ? 0 : queued * 100 / capacity);
+    }
+    void recordUnderrun() {
+        underruns.fetch_add(1, memory_order_relaxed);
+    }
+    void recordDroppedFrame() {
+        droppedFrames.fetch_add(1, memory_order_relaxed);
+    }
+
+    TelemetrySnapshot snapshot() const {
+        return {timeToFirstSample.summarize(), transitionGap.summarize(),
+                decodeThroughput.summarize(), bufferFill.summarize(),
+                underruns.load(memory_order_relaxed), droppedFrames.load(memory_order_relaxed)};
+    }
+
+    void dumpText(ostream& out) const {
+        TelemetrySnapshot snap = snapshot();
+        printRow(out, "time to first sample", snap.timeToFirstSampleUs, "us");
+        printRow(out, "track transition gap", snap.transitionGapUs, "us");
+        printRow(out, "decode throughput", snap.decodeSamplesPerSecond, "samples/s");
+        printRow(out, "output buffer fill", snap.bufferFillPercent, "%");
+        out << "  underruns=" << snap.underruns << " dropped frames=" << snap.droppedFrames << "\n";
+    }
+};
+
+// Dumps every registered telemetry source to a stream at a fixed interval.
+class TelemetryReporter {
+private:
+    ostream& out;
+    chrono::milliseconds interval;
+    mutex mtx;
+    condition_variable stopRequested;
+    bool stopping;
+    vector<pair<string, shared_ptr<PlaybackTelemetry>>> sources;
+    thread worker;
+
+    void run() {
+        unique_lock<mutex> lock(mtx);
+        while (!stopRequested.wait_for(lock, interval, [this]() { return stopping; })) {
+            for (auto& source : sources) {
+                out << "[Telemetry] " << source.first << "\n";
+                source.second->dumpText(out);
+            }
+            out.flush();
+        }
+    }
+
+public:
+    TelemetryReporter(ostream& out, chrono::milliseconds interval) : out(out) {
+        this->interval = interval;
+        stopping = false;
+        worker = thread(&TelemetryReporter::run, this);
+    }
+
+    ~TelemetryReporter() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        stopRequested.notify_all();
+        worker.join();
+    }
+
+    void addSource(const string& name, shared_ptr<PlaybackTelemetry> telemetry) {
+        lock_guard<mutex> lock(mtx);
+        sources.push_back({name, telemetry});
+    }
 };
 
 
@@ -116,6 +342,9 @@ public:
     virtual	shared_ptr<Song> previous() = 0;
     virtual bool hasPrevious() = 0;
     virtual void addToNext (shared_ptr<Song> song) {}
+    virtual void onSongRated(shared_ptr<Song>) {}
+    // Upcoming songs in play order, WITHOUT advancing the strategy.
+    virtual vector<shared_ptr<Song>> peekNext(int count) = 0;
 };
 
 
@@ -159,6 +388,18 @@ public:
         currentIndex = currentIndex - 1;
         return currentPlaylist->getSongs()[currentIndex];
     }
+
+    vector<shared_ptr<Song>> peekNext(int count) override {
+        vector<shared_ptr<Song>> upcoming;
+        if (!currentPlaylist) {
+            return upcoming;
+        }
+        const vector<shared_ptr<Song>> songs = currentPlaylist->getSongs();
+        for (int i = currentIndex + 1; i < (int)songs.size() && (int)upcoming.size() < count; i++) {
+            upcoming.push_back(songs[i]);
+        }
+        return upcoming;
+    }
 };
 
 
@@ -166,12 +407,24 @@ class RandomPlayStrategy : public PlayStrategy {
 private:
     shared_ptr<Playlist> currentPlaylist;
     vector<shared_ptr<Song>> remainingSongs; 
+    deque<shared_ptr<Song>> drawnAhead;   // picked by peekNext(), played before new draws
     stack<shared_ptr<Song>> history; 
+    minstd_rand rng;   // per instance: rand() shares one locked global state
+
+    shared_ptr<Song> drawRandom() {
+        int idx = rng() % remainingSongs.size();
+        shared_ptr<Song> selectedSong = remainingSongs[idx];
+
+        // Remove the selectedSong from the list. (Swap and pop to remove in O(1))
+        swap(remainingSongs[idx], remainingSongs.back());
+        remainingSongs.pop_back();
+        return selectedSong;
+    }
 
 public:
     RandomPlayStrategy() {
         currentPlaylist = nullptr;
-        srand((unsigned)time(nullptr));
+        rng.seed((unsigned)time(nullptr) ^ (unsigned)(uintptr_t)this);
     }
 
     void setPlaylist(shared_ptr<Playlist> playlist) override {
@@ -179,11 +432,12 @@ public:
         if (!currentPlaylist || currentPlaylist->getSize() == 0) return;
 
         remainingSongs = currentPlaylist->getSongs();
+        drawnAhead.clear();
         history = stack<shared_ptr<Song>>(); 
     }
 
     bool hasNext() override {
-        return currentPlaylist && !remainingSongs.empty();
+        return currentPlaylist && (!drawnAhead.empty() || !remainingSongs.empty());
     }
 
     // Next in Loop
@@ -191,16 +445,17 @@ public:
         if (!currentPlaylist || currentPlaylist->getSize() == 0) {
             throw runtime_error("No playlist loaded or playlist is empty.");
         }
-        if (remainingSongs.empty()) {
+        if (drawnAhead.empty() && remainingSongs.empty()) {
             throw runtime_error("No songs left to play");
         }
 
-        int idx = rand() % remainingSongs.size();
-        shared_ptr<Song> selectedSong = remainingSongs[idx];
-
-        // Remove the selectedSong from the list. (Swap and pop to remove in O(1))
-        swap(remainingSongs[idx], remainingSongs.back());
-        remainingSongs.pop_back();
+        shared_ptr<Song> selectedSong;
+        if (!drawnAhead.empty()) {
+            selectedSong = drawnAhead.front();
+            drawnAhead.pop_front();
+        } else {
+            selectedSong = drawRandom();
+        }
 
         history.push(selectedSong);
         return selectedSong;
@@ -219,13 +474,23 @@ public:
         history.pop();
         return song;
     }
+
+    // Peeking commits the random picks, so the songs returned here are
+    // exactly the ones next() will hand out.
+    vector<shared_ptr<Song>> peekNext(int count) override {
+        while ((int)drawnAhead.size() < count && !remainingSongs.empty()) {
+            drawnAhead.push_back(drawRandom());
+        }
+        int available = min(count, (int)drawnAhead.size());
+        return vector<shared_ptr<Song>>(drawnAhead.begin(), drawnAhead.begin() + available);
+    }
 };
 
 class CustomQueueStrategy : public PlayStrategy {
 private:
     shared_ptr<Playlist> currentPlaylist;
     int currentIndex;
-    queue<shared_ptr<Song>> nextQueue;
+    deque<shared_ptr<Song>> nextQueue;
     stack<shared_ptr<Song>> prevStack;
 
    	shared_ptr<Song> nextSequential() {
@@ -253,9 +518,7 @@ public:
     void setPlaylist(shared_ptr<Playlist> playlist) override {
         currentPlaylist = playlist;
         currentIndex = -1;
-        while (!nextQueue.empty()) {
-            nextQueue.pop();
-        }
+        nextQueue.clear();
         while(!prevStack.empty()) {
             prevStack.pop();
         }
@@ -272,7 +535,7 @@ public:
 
         if (!nextQueue.empty()) {
            	shared_ptr<Song> s = nextQueue.front();
-            nextQueue.pop();
+            nextQueue.pop_front();
             prevStack.push(s);
 
             // update index to match queued song
@@ -322,7 +585,260 @@ public:
         if (!song) {
             throw runtime_error("Cannot enqueue null song.");
         }
-        nextQueue.push(song);
+        nextQueue.push_back(song);
+    }
+
+    // Queued songs first, then sequential from wherever the last queued song sits.
+    vector<shared_ptr<Song>> peekNext(int count) override {
+        vector<shared_ptr<Song>> upcoming;
+        if (!currentPlaylist) {
+            return upcoming;
+        }
+        const vector<shared_ptr<Song>> list = currentPlaylist->getSongs();
+        int index = currentIndex;
+        for (const shared_ptr<Song>& s : nextQueue) {
+            if ((int)upcoming.size() >= count) {
+                return upcoming;
+            }
+            upcoming.push_back(s);
+            for (int i = 0; i < (int)list.size(); ++i) {
+                if (list[i] == s) {
+                    index = i;
+                    break;
+                }
+            }
+        }
+        while ((int)upcoming.size() < count && index + 1 < (int)list.size()) {
+            index = index + 1;
+            upcoming.push_back(list[index]);
+        }
+        return upcoming;
+    }
+};
+
+
+/////////////////////////////////////////////////
+//          SMART SHUFFLE
+////////////////////////////////////////////////
+
+// Fenwick (binary indexed) tree over integer weights: O(log n) weight
+// updates and O(log n) "which slot does this cumulative weight land in".
+class FenwickTree {
+private:
+    vector<uint64_t> tree;     // 1-based partial sums
+    vector<uint64_t> weights;
+    uint64_t totalWeight;
+public:
+    FenwickTree() {
+        totalWeight = 0;
+    }
+
+    // O(n) build.
+    void assign(const vector<uint64_t>& initial) {
+        weights = initial;
+        tree.assign(initial.size() + 1, 0);
+        totalWeight = 0;
+        for (size_t i = 1; i < tree.size(); i++) {
+            tree[i] += initial[i - 1];
+            totalWeight += initial[i - 1];
+            size_t parent = i + (i & (~i + 1));
+            if (parent < tree.size()) {
+                tree[parent] += tree[i];
+            }
+        }
+    }
+
+    int size() const {
+        return (int)weights.size();
+    }
+    uint64_t total() const {
+        return totalWeight;
+    }
+    uint64_t get(int index) const {
+        return weights[index];
+    }
+
+    void set(int index, uint64_t weight) {
+        uint64_t old = weights[index];
+        weights[index] = weight;
+        totalWeight = totalWeight - old + weight;
+        for (size_t i = index + 1; i < tree.size(); i += i & (~i + 1)) {
+            tree[i] = tree[i] - old + weight;
+        }
+    }
+
+    // Smallest index whose running total exceeds `target` (target < total()).
+    int find(uint64_t target) const {
+        size_t pos = 0;
+        size_t step = 1;
+        while (step * 2 < tree.size()) {
+            step *= 2;
+        }
+        for (; step > 0; step /= 2) {
+            if (pos + step < tree.size() && tree[pos + step] <= target) {
+                pos += step;
+                target -= tree[pos];
+            }
+        }
+        return (int)pos;
+    }
+};
+
+
+// Weighted shuffle that keeps the same artist from playing back-to-back.
+// Two levels of Fenwick trees: pick an artist by its remaining weight,
+// then a track within that artist. Each pick and each weight update is
+// O(log artists + log tracks), so nothing is rebuilt between picks.
+//   - rating:  a track's weight doubles per star (unrated counts as 3 stars)
+//   - recency: a played track drops to weight 0 for the rest of the pass
+//   - spread:  the last few artists played have their weight cut
+class SmartShufflePlayStrategy : public PlayStrategy {
+private:
+    static constexpr int ARTIST_SPREAD_WINDOW = 3;
+    static constexpr uint64_t COOLDOWN_DIVISOR = 16;
+
+    struct ArtistTracks {
+        vector<shared_ptr<Song>> songs;
+        FenwickTree trackWeights;
+        int cooldown;   // times this artist appears in recentArtists
+    };
+
+    shared_ptr<Playlist> currentPlaylist;
+    vector<ArtistTracks> artists;
+    FenwickTree artistWeights;
+    unordered_map<Song*, pair<int, int>> slotOf;   // song -> (artist, track)
+    deque<int> recentArtists;
+    int spreadWindow;
+    deque<shared_ptr<Song>> drawnAhead;
+    stack<shared_ptr<Song>> history;
+    minstd_rand rng;
+
+    static uint64_t ratingWeight(int stars) {
+        return 1ull << (stars == 0 ? 3 : stars);
+    }
+
+    void refreshArtistWeight(int artist) {
+        uint64_t weight = artists[artist].trackWeights.total();
+        if (artists[artist].cooldown > 0 && weight > 0) {
+            weight = max<uint64_t>(1, weight / COOLDOWN_DIVISOR);
+        }
+        artistWeights.set(artist, weight);
+    }
+
+    shared_ptr<Song> drawWeighted() {
+        uint64_t target = uniform_int_distribution<uint64_t>(0, artistWeights.total() - 1)(rng);
+        int artist = artistWeights.find(target);
+        ArtistTracks& bucket = artists[artist];
+        target = uniform_int_distribution<uint64_t>(0, bucket.trackWeights.total() - 1)(rng);
+        int track = bucket.trackWeights.find(target);
+
+        bucket.trackWeights.set(track, 0);
+        bucket.cooldown++;
+        recentArtists.push_back(artist);
+        refreshArtistWeight(artist);
+        if ((int)recentArtists.size() > spreadWindow) {
+            int expired = recentArtists.front();
+            recentArtists.pop_front();
+            artists[expired].cooldown--;
+            refreshArtistWeight(expired);
+        }
+        return bucket.songs[track];
+    }
+
+public:
+    SmartShufflePlayStrategy() {
+        currentPlaylist = nullptr;
+        spreadWindow = 0;
+        rng.seed((unsigned)time(nullptr) ^ (unsigned)(uintptr_t)this);
+    }
+
+    void setPlaylist(shared_ptr<Playlist> playlist) override {
+        currentPlaylist = playlist;
+        artists.clear();
+        slotOf.clear();
+        recentArtists.clear();
+        drawnAhead.clear();
+        history = stack<shared_ptr<Song>>();
+        if (!currentPlaylist) return;
+
+        unordered_map<string, int> artistIds;
+        vector<vector<uint64_t>> trackWeights;
+        for (const shared_ptr<Song>& song : currentPlaylist->getSongs()) {
+            auto found = artistIds.emplace(song->getArtist(), (int)artists.size());
+            if (found.second) {
+                artists.push_back({{}, FenwickTree(), 0});
+                trackWeights.push_back({});
+            }
+            int artist = found.first->second;
+            slotOf[song.get()] = {artist, (int)artists[artist].songs.size()};
+            artists[artist].songs.push_back(song);
+            trackWeights[artist].push_back(ratingWeight(song->getRating()));
+        }
+
+        vector<uint64_t> perArtist;
+        for (size_t a = 0; a < artists.size(); a++) {
+            artists[a].trackWeights.assign(trackWeights[a]);
+            perArtist.push_back(artists[a].trackWeights.total());
+        }
+        artistWeights.assign(perArtist);
+        // With fewer artists than the window every artist would be cooling down.
+        spreadWindow = min(ARTIST_SPREAD_WINDOW, max(0, (int)artists.size() - 1));
+    }
+
+    bool hasNext() override {
+        return currentPlaylist && (!drawnAhead.empty() || artistWeights.total() > 0);
+    }
+
+    shared_ptr<Song> next() override {
+        if (!currentPlaylist || currentPlaylist->getSize() == 0) {
+            throw runtime_error("No playlist loaded or playlist is empty.");
+        }
+        if (!hasNext()) {
+            throw runtime_error("No songs left to play");
+        }
+
+        shared_ptr<Song> selectedSong;
+        if (!drawnAhead.empty()) {
+            selectedSong = drawnAhead.front();
+            drawnAhead.pop_front();
+        } else {
+            selectedSong = drawWeighted();
+        }
+        history.push(selectedSong);
+        return selectedSong;
+    }
+
+    bool hasPrevious() override {
+        return history.size() > 0;
+    }
+
+    shared_ptr<Song> previous() override {
+        if (history.empty()) {
+            throw std::runtime_error("No previous song available.");
+        }
+        shared_ptr<Song> song = history.top();
+        history.pop();
+        return song;
+    }
+
+    // Like RandomPlayStrategy, peeking commits the draws.
+    vector<shared_ptr<Song>> peekNext(int count) override {
+        while ((int)drawnAhead.size() < count && artistWeights.total() > 0) {
+            drawnAhead.push_back(drawWeighted());
+        }
+        int available = min(count, (int)drawnAhead.size());
+        return vector<shared_ptr<Song>>(drawnAhead.begin(), drawnAhead.begin() + available);
+    }
+
+    // Re-weights a song still waiting to be played, in place.
+    void onSongRated(shared_ptr<Song> song) override {
+        auto it = slotOf.find(song.get());
+        if (it == slotOf.end()) return;
+        ArtistTracks& bucket = artists[it->second.first];
+        int track = it->second.second;
+        if (bucket.trackWeights.get(track) == 0) return;   // already played this pass
+        bucket.trackWeights.set(track, ratingWeight(song->getRating()));
+        refreshArtistWeight(it->second.first);
     }
 };
 
@@ -334,25 +850,34 @@ public:
 class BluetoothSpeakerAPI {
 public:
   void playSoundViaBluetooth(const string& data) {
-      cout << "[BluetoothSpeaker] Playing: " << data << "\n";
+      cout << "[BluetoothSpeaker] Playing: " + data + "\n";
       // mimics playing music
   }
+  void streamViaBluetooth(const int16_t*, size_t) {
+      // mimics sending PCM samples to the speaker
+  }
 };
 
 class HeadphonesAPI {
 public:
     void playSoundViaJack(const string& data) {
-        cout << "[Headphones] Playing: " << data << "\n";
+        cout << "[Headphones] Playing: " + data + "\n";
         // mimics playing music
     }
+    void streamViaJack(const int16_t*, size_t) {
+        // mimics sending PCM samples to the jack
+    }
 };
 
 class WiredSpeakerAPI {
 public:
     void playSoundViaCable(const string& data) {
-        cout << "[WiredSpeaker] Playing: " << data << "\n";
+        cout << "[WiredSpeaker] Playing: " + data + "\n";
         // mimics playing music
     }
+    void streamViaCable(const int16_t*, size_t) {
+        // mimics sending PCM samples down the cable
+    }
 };
 
 
@@ -365,6 +890,16 @@ class IAudioOutputDevice {
 public:
 	virtual ~IAudioOutputDevice() {}
 	virtual void playAudio(shared_ptr<Song> song) = 0;
+	virtual void writeFrame(const FrameBuffer& frame) = 0;
+	// A new track asked for at `requestedAt`; devices that time playback
+	// override this, the rest just start playing.
+	virtual void startTrack(shared_ptr<Song> song, chrono::steady_clock::time_point) {
+		playAudio(song);
+	}
+	// The current track's last frame has been written.
+	virtual void endTrack() {}
+	// Time from handing audio to the device until it is audible.
+	virtual int getLatencyMs() const = 0;
 };
 
 
@@ -381,6 +916,14 @@ public:
 		string payload = song->getTitle() + " by " + song->getArtist();
     bluetoothApi->playSoundViaBluetooth(payload);
 	}
+
+	void writeFrame(const FrameBuffer& frame) override {
+		bluetoothApi->streamViaBluetooth(frame->data(), frame->size());
+	}
+
+	int getLatencyMs() const override {
+		return 150;
+	}
 };
 
 class HeadphonesAdapter : public IAudioOutputDevice {
@@ -395,6 +938,14 @@ public:
         string payload = song->getTitle() + " by " + song->getArtist();
         headphonesApi->playSoundViaJack(payload);
     }
+
+    void writeFrame(const FrameBuffer& frame) override {
+        headphonesApi->streamViaJack(frame->data(), frame->size());
+    }
+
+    int getLatencyMs() const override {
+        return 10;
+    }
 };
 
 class WiredSpeakerAdapter : public IAudioOutputDevice {
@@ -409,6 +960,14 @@ public:
         string payload = song->getTitle() + " by " + song->getArtist();
         wiredApi->playSoundViaCable(payload);
     }
+
+    void writeFrame(const FrameBuffer& frame) override {
+        wiredApi->streamViaCable(frame->data(), frame->size());
+    }
+
+    int getLatencyMs() const override {
+        return 5;
+    }
 };
 
 
@@ -441,11 +1000,13 @@ private:
     shared_ptr<PlayStrategy> sequentialStrategy;
     shared_ptr<PlayStrategy> randomStrategy;
     shared_ptr<PlayStrategy> customQueueStrategy;
+    shared_ptr<PlayStrategy> smartShuffleStrategy;
 
     StrategyManager() {
-        sequentialStrategy = make_shared<SequentialPlayStrategy>();
-        randomStrategy = make_shared<RandomPlayStrategy>();
-        customQueueStrategy = make_shared<CustomQueueStrategy>();
+        sequentialStrategy = createStrategy(PlayStrategyType::SEQUENTIAL);
+        randomStrategy = createStrategy(PlayStrategyType::RANDOM);
+        customQueueStrategy = createStrategy(PlayStrategyType::CUSTOM_QUEUE);
+        smartShuffleStrategy = createStrategy(PlayStrategyType::SMART_SHUFFLE);
     }
 public:
     static StrategyManager* getInstance() {
@@ -457,13 +1018,28 @@ public:
         }
         return instance;
     }
+    // A fresh, unshared strategy (e.g. one per listening session).
+    static shared_ptr<PlayStrategy> createStrategy(PlayStrategyType type) {
+        if (type == PlayStrategyType::SEQUENTIAL) {
+            return make_shared<SequentialPlayStrategy>();
+        } else if (type == PlayStrategyType::RANDOM) {
+            return make_shared<RandomPlayStrategy>();
+        } else if (type == PlayStrategyType::CUSTOM_QUEUE) {
+            return make_shared<CustomQueueStrategy>();
+        } else {
+            return make_shared<SmartShufflePlayStrategy>();
+        }
+    }
+
     shared_ptr<PlayStrategy> getStrategy(PlayStrategyType type) {
         if (type == PlayStrategyType::SEQUENTIAL) {
             return sequentialStrategy;
         } else if (type == PlayStrategyType::RANDOM) {
             return randomStrategy;
-        } else {
+        } else if (type == PlayStrategyType::CUSTOM_QUEUE) {
             return customQueueStrategy;
+        } else {
+            return smartShuffleStrategy;
         }
     }
 };
@@ -473,56 +1049,366 @@ mutex StrategyManager::mtx;
 
 
 /////////////////////////////////////////////////
-//          DEVICE MANAGER
+//          DEVICE OUTPUT CHANNELS
 ////////////////////////////////////////////////
 
-class DeviceManager {
+// Feeds one device from its own queue on its own thread, so a slow device
+// only ever falls behind itself. Every event is held back by the device's
+// latency compensation, which lines it up with the slowest connected device.
+class DeviceOutputChannel {
 private:
-    static DeviceManager* instance;
-    static mutex mtx;
-    shared_ptr<IAudioOutputDevice> currentOutputDevice;
-    DeviceManager() {
-        currentOutputDevice = nullptr;
-    }
-public:
-    static DeviceManager* getInstance() {
-        if (instance == nullptr) {
-        		lock_guard<mutex> lock(mtx);
-        		if (instance == nullptr) {
-            	instance = new DeviceManager();
+    struct OutputEvent {
+        shared_ptr<Song> trackStart;   // set when a new track starts
+        FrameBuffer frame;             // set for audio data
+        bool trackEnd;                 // set after a track's last frame
+        chrono::steady_clock::time_point requestedAt;   // trackStart only; zero if unknown
+        chrono::steady_clock::time_point dueAt;
+    };
+
+    shared_ptr<IAudioOutputDevice> device;
+    shared_ptr<PlaybackTelemetry> telemetry;   // may be null
+    size_t capacity;
+    deque<OutputEvent> pending;
+    chrono::milliseconds compensation;
+    long long droppedFrames;
+    bool busy;
+    bool stopping;
+    mutex mtx;
+    condition_variable wakeUp;
+    condition_variable drained;
+    thread worker;
+    // Worker-only playback state for telemetry.
+    bool hasPlayedFrame;
+    bool awaitingFirstFrame;                      // a track started after earlier audio
+    bool awaitingFirstSample;                     // a track started with a known request time
+    bool midTrack;                                // a track is playing and more frames are due
+    chrono::steady_clock::time_point lastFrameAt;
+    chrono::steady_clock::time_point nextFrameWantedAt;   // when the last frame has played out
+    chrono::steady_clock::time_point gapStartAt;
+    chrono::steady_clock::time_point trackRequestedAt;
+
+    void run() {
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            // Part-way through a track the device needs its next frame once
+            // the last one has played out; if none is queued by then it runs dry.
+            if (pending.empty() && midTrack) {
+                bool fed = wakeUp.wait_until(lock, nextFrameWantedAt,
+                    [this]() { return stopping || !pending.empty(); });
+                if (!fed && telemetry) {
+                    telemetry->recordUnderrun();
+                }
+            }
+            wakeUp.wait(lock, [this]() { return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;   // stopping, and everything queued has been played
+            }
+            OutputEvent event = move(pending.front());
+            pending.pop_front();
+            busy = true;
+            lock.unlock();
+
+            this_thread::sleep_until(event.dueAt);
+            if (event.trackStart) {
+                device->playAudio(event.trackStart);
+                // The gap runs from the previous track's last frame, but not
+                // from before this track was asked for: waiting on the
+                // listener is not a gap.
+                awaitingFirstFrame = hasPlayedFrame;
+                gapStartAt = max(lastFrameAt, event.dueAt);
+                awaitingFirstSample = event.requestedAt != chrono::steady_clock::time_point();
+                trackRequestedAt = event.requestedAt;
+                midTrack = false;
+            } else if (event.trackEnd) {
+                midTrack = false;
+            } else {
+                device->writeFrame(event.frame);
+                lastFrameAt = chrono::steady_clock::now();
+                nextFrameWantedAt = lastFrameAt
+                    + chrono::microseconds(event.frame->size() * 1000000 / SAMPLE_RATE_HZ);
+                if (awaitingFirstFrame && telemetry) {
+                    telemetry->recordTransitionGap(lastFrameAt - gapStartAt);
+                }
+                if (awaitingFirstSample && telemetry) {
+                    telemetry->recordTimeToFirstSample(lastFrameAt - trackRequestedAt);
+                }
+                hasPlayedFrame = true;
+                awaitingFirstFrame = false;
+                awaitingFirstSample = false;
+                midTrack = true;
+            }
+
+            lock.lock();
+            busy = false;
+            if (pending.empty()) {
+                drained.notify_all();
             }
         }
-        return instance;
     }
-    void connect(DeviceType deviceType) {
-        currentOutputDevice = DeviceFactory::createDevice(deviceType);
 
-        switch(deviceType) {
-            case DeviceType::BLUETOOTH:
-                cout<< "Bluetooth device connected \n";
-                break;
-            case DeviceType::WIRED:
-                cout<< "Wired device connected \n";
-                break;
-            case DeviceType::HEADPHONES:
-                cout<< "Headphones connected \n";
+public:
+    DeviceOutputChannel(shared_ptr<IAudioOutputDevice> device, size_t capacity = 64,
+                        shared_ptr<PlaybackTelemetry> telemetry = nullptr) {
+        this->device = device;
+        this->telemetry = telemetry;
+        this->capacity = capacity;
+        compensation = chrono::milliseconds(0);
+        droppedFrames = 0;
+        busy = false;
+        stopping = false;
+        hasPlayedFrame = false;
+        awaitingFirstFrame = false;
+        awaitingFirstSample = false;
+        midTrack = false;
+        worker = thread(&DeviceOutputChannel::run, this);
+    }
+
+    // Plays out whatever is still queued before returning.
+    ~DeviceOutputChannel() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
         }
+        wakeUp.notify_all();
+        worker.join();
     }
 
-    shared_ptr<IAudioOutputDevice> getOutputDevice() {
-        if (!currentOutputDevice) {
-            throw runtime_error("No output device is connected.");
-        }
-        return currentOutputDevice;
+    int getLatencyMs() const {
+        return device->getLatencyMs();
     }
 
-    bool hasOutputDevice() {
-        return currentOutputDevice != nullptr;
+    void setCompensationMs(int ms) {
+        lock_guard<mutex> lock(mtx);
+        compensation = chrono::milliseconds(ms);
     }
-};
 
-DeviceManager* DeviceManager::instance = nullptr;
-mutex DeviceManager::mtx;
+    long long getDroppedFrames() {
+        lock_guard<mutex> lock(mtx);
+        return droppedFrames;
+    }
+
+    // Never blocks the caller: when the queue is full the oldest queued
+    // frame is dropped. Track starts and ends are never dropped; if only
+    // those are queued, an incoming frame is dropped instead and an incoming
+    // start or end goes in over capacity.
+    void submit(shared_ptr<Song> trackStart, FrameBuffer frame, bool trackEnd = false,
+                chrono::steady_clock::time_point requestedAt = chrono::steady_clock::time_point()) {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (pending.size() >= capacity) {
+                auto oldestFrame = find_if(pending.begin(), pending.end(),
+                    [](const OutputEvent& e) { return e.frame != nullptr; });
+                bool evicted = oldestFrame != pending.end();
+                if (evicted) {
+                    pending.erase(oldestFrame);
+                }
+                if (evicted || frame != nullptr) {
+                    droppedFrames++;
+                    if (telemetry) {
+                        telemetry->recordDroppedFrame();
+                    }
+                }
+                if (!evicted && frame != nullptr) {
+                    return;
+                }
+            }
+            pending.push_back({trackStart, frame, trackEnd, requestedAt, chrono::steady_clock::now() + compensation});
+            if (telemetry) {
+                telemetry->recordBufferFill(pending.size(), capacity);
+            }
+        }
+        wakeUp.notify_one();
+    }
+
+    void flush() {
+        unique_lock<mutex> lock(mtx);
+        drained.wait(lock, [this]() { return pending.empty() && !busy; });
+    }
+};
+
+
+// Composite device: fans everything out to all connected channels. Frames
+// are shared pointers to read-only buffers, so every device gets the same
+// buffer rather than a copy.
+class MultiDeviceOutput : public IAudioOutputDevice {
+private:
+    vector<shared_ptr<DeviceOutputChannel>> channels;
+public:
+    MultiDeviceOutput(vector<shared_ptr<DeviceOutputChannel>> channels) {
+        this->channels = channels;
+    }
+
+    void playAudio(shared_ptr<Song> song) override {
+        for (shared_ptr<DeviceOutputChannel>& channel : channels) {
+            channel->submit(song, nullptr);
+        }
+    }
+
+    void writeFrame(const FrameBuffer& frame) override {
+        for (shared_ptr<DeviceOutputChannel>& channel : channels) {
+            channel->submit(nullptr, frame);
+        }
+    }
+
+    void startTrack(shared_ptr<Song> song, chrono::steady_clock::time_point requestedAt) override {
+        for (shared_ptr<DeviceOutputChannel>& channel : channels) {
+            channel->submit(song, nullptr, false, requestedAt);
+        }
+    }
+
+    void endTrack() override {
+        for (shared_ptr<DeviceOutputChannel>& channel : channels) {
+            channel->submit(nullptr, nullptr, true);
+        }
+    }
+
+    int getLatencyMs() const override {
+        int latency = 0;
+        for (const shared_ptr<DeviceOutputChannel>& channel : channels) {
+            latency = max(latency, channel->getLatencyMs());
+        }
+        return latency;
+    }
+
+    void flush() {
+        for (shared_ptr<DeviceOutputChannel>& channel : channels) {
+            channel->flush();
+        }
+    }
+};
+
+
+/////////////////////////////////////////////////
+//          DEVICE MANAGER
+////////////////////////////////////////////////
+
+class DeviceManager {
+private:
+    static DeviceManager* instance;
+    static mutex mtx;
+    mutex devicesMtx;
+    map<DeviceType, shared_ptr<DeviceOutputChannel>> channels;
+    shared_ptr<MultiDeviceOutput> currentOutput;   // rebuilt whenever devices change
+    shared_ptr<PlaybackTelemetry> telemetry;
+    DeviceManager() {
+        currentOutput = nullptr;
+        telemetry = nullptr;
+    }
+
+    // Delay every device up to the slowest one so they all sound together.
+    void rebuildOutput() {
+        vector<shared_ptr<DeviceOutputChannel>> connected;
+        int maxLatency = 0;
+        for (auto& entry : channels) {
+            connected.push_back(entry.second);
+            maxLatency = max(maxLatency, entry.second->getLatencyMs());
+        }
+        for (shared_ptr<DeviceOutputChannel>& channel : connected) {
+            channel->setCompensationMs(maxLatency - channel->getLatencyMs());
+        }
+        currentOutput = connected.empty() ? nullptr : make_shared<MultiDeviceOutput>(connected);
+    }
+
+public:
+    static DeviceManager* getInstance() {
+        if (instance == nullptr) {
+        		lock_guard<mutex> lock(mtx);
+        		if (instance == nullptr) {
+            	instance = new DeviceManager();
+            }
+        }
+        return instance;
+    }
+
+    // Adds the device alongside those already connected (reconnecting a type replaces it).
+    void connect(DeviceType deviceType) {
+        // A replaced channel plays out its queue when destroyed; that happens
+        // after the lock is released, not while every other caller waits.
+        shared_ptr<DeviceOutputChannel> replaced;
+        shared_ptr<MultiDeviceOutput> previousOutput;
+        {
+            lock_guard<mutex> lock(devicesMtx);
+            shared_ptr<DeviceOutputChannel>& slot = channels[deviceType];
+            replaced = slot;
+            slot = make_shared<DeviceOutputChannel>(DeviceFactory::createDevice(deviceType), 64, telemetry);
+            previousOutput = currentOutput;
+            rebuildOutput();
+        }
+
+        switch(deviceType) {
+            case DeviceType::BLUETOOTH:
+                cout<< "Bluetooth device connected \n";
+                break;
+            case DeviceType::WIRED:
+                cout<< "Wired device connected \n";
+                break;
+            case DeviceType::HEADPHONES:
+                cout<< "Headphones connected \n";
+        }
+    }
+
+    // Devices connected from now on report buffer fill / underruns here.
+    void setTelemetry(shared_ptr<PlaybackTelemetry> telemetry) {
+        lock_guard<mutex> lock(devicesMtx);
+        this->telemetry = telemetry;
+    }
+
+    // Plays out anything still queued for the device, then drops it.
+    void disconnect(DeviceType deviceType) {
+        shared_ptr<DeviceOutputChannel> removed;
+        {
+            lock_guard<mutex> lock(devicesMtx);
+            auto it = channels.find(deviceType);
+            if (it == channels.end()) {
+                return;
+            }
+            removed = it->second;
+            channels.erase(it);
+            rebuildOutput();
+        }
+        removed->flush();
+    }
+
+    void disconnectAll() {
+        map<DeviceType, shared_ptr<DeviceOutputChannel>> removed;
+        {
+            lock_guard<mutex> lock(devicesMtx);
+            removed.swap(channels);
+            rebuildOutput();
+        }
+        for (auto& entry : removed) {
+            entry.second->flush();
+        }
+    }
+
+    // Waits until every connected device has played out what it was given.
+    void flush() {
+        shared_ptr<MultiDeviceOutput> output;
+        {
+            lock_guard<mutex> lock(devicesMtx);
+            output = currentOutput;
+        }
+        if (output) {
+            output->flush();
+        }
+    }
+
+    shared_ptr<IAudioOutputDevice> getOutputDevice() {
+        lock_guard<mutex> lock(devicesMtx);
+        if (!currentOutput) {
+            throw runtime_error("No output device is connected.");
+        }
+        return currentOutput;
+    }
+
+    bool hasOutputDevice() {
+        lock_guard<mutex> lock(devicesMtx);
+        return currentOutput != nullptr;
+    }
+};
+
+DeviceManager* DeviceManager::instance = nullptr;
+mutex DeviceManager::mtx;
 
 
 /////////////////////////////////////////////////
@@ -571,6 +1457,260 @@ public:
 PlaylistManager* PlaylistManager::instance = nullptr;
 mutex PlaylistManager::mtx;
 
+/////////////////////////////////////////////////
+//          TRACK LOADING
+////////////////////////////////////////////////
+
+class MappedFile {
+private:
+    const char* data;
+    size_t length;
+public:
+    MappedFile() {
+        data = nullptr;
+        length = 0;
+    }
+    ~MappedFile() {
+        if (data) {
+            munmap((void*)data, length);
+        }
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        data = (const char*)addr;
+        length = st.st_size;
+        return true;
+    }
+    const char* getData() const {
+        return data;
+    }
+    size_t getLength() const {
+        return length;
+    }
+};
+
+class DecodedTrack {
+private:
+    shared_ptr<Song> song;
+    unique_ptr<MappedFile> file;        // null when the song isn't on disk
+    vector<FrameBuffer> leadingFrames;  // first buffers, ready to hand to a device
+    size_t decodedBytes;                // how far into the file decoding has got
+public:
+    static constexpr int SAMPLES_PER_FRAME = 1024;
+
+    DecodedTrack(shared_ptr<Song> s, unique_ptr<MappedFile> f) {
+        song = s;
+        file = move(f);
+        decodedBytes = 0;
+    }
+    shared_ptr<Song> getSong() {
+        return song;
+    }
+    bool isMapped() const {
+        return file != nullptr;
+    }
+    const vector<FrameBuffer>& getLeadingFrames() const {
+        return leadingFrames;
+    }
+
+    // mimics decoding: widen raw bytes into PCM samples.
+    // Past the end of the file, or with no file, this is silence.
+    FrameBuffer decodeNextFrame() {
+        shared_ptr<AudioFrame> frame = make_shared<AudioFrame>(SAMPLES_PER_FRAME, 0);
+        for (int i = 0; file && i < SAMPLES_PER_FRAME && decodedBytes < file->getLength(); i++) {
+            (*frame)[i] = (int16_t)(file->getData()[decodedBytes++] << 8);
+        }
+        return frame;
+    }
+
+    void decodeLeadingFrames(int count) {
+        for (int f = 0; f < count; f++) {
+            leadingFrames.push_back(decodeNextFrame());
+        }
+    }
+
+    // Once written out, the device queues own the leading frames.
+    void releaseLeadingFrames() {
+        vector<FrameBuffer>().swap(leadingFrames);
+    }
+};
+
+class TrackLoader {
+public:
+    static constexpr int LEADING_FRAMES = 8;
+
+    // Opens + maps the song file and decodes its first buffers.
+    // Songs whose file is missing decode to silence.
+    static shared_ptr<DecodedTrack> load(shared_ptr<Song> song, PlaybackTelemetry* telemetry = nullptr) {
+        unique_ptr<MappedFile> file = make_unique<MappedFile>();
+        if (file->open(song->getFilePath())) {
+            madvise((void*)file->getData(), file->getLength(), MADV_WILLNEED);
+        } else {
+            file = nullptr;
+        }
+
+        bool mapped = file != nullptr;
+        shared_ptr<DecodedTrack> track = make_shared<DecodedTrack>(song, move(file));
+        auto decodeStart = chrono::steady_clock::now();
+        track->decodeLeadingFrames(LEADING_FRAMES);
+        if (telemetry && mapped) {   // silence for a missing file is not a decode
+            telemetry->recordDecode((uint64_t)LEADING_FRAMES * DecodedTrack::SAMPLES_PER_FRAME,
+                                    chrono::steady_clock::now() - decodeStart);
+        }
+        return track;
+    }
+};
+
+
+/////////////////////////////////////////////////
+//          TRACK PREFETCHER
+////////////////////////////////////////////////
+
+// Loads the strategy's upcoming songs in the background so a track change
+// only has to pick up an already decoded track. Loads run one at a time on
+// a worker thread the prefetcher owns; songs that stop being upcoming
+// before their turn are never loaded.
+class TrackPrefetcher {
+private:
+    typedef promise<shared_ptr<DecodedTrack>> PendingLoad;
+
+    mutex mtx;
+    condition_variable workAvailable;
+    map<shared_ptr<Song>, shared_future<shared_ptr<DecodedTrack>>> inFlight;
+    deque<pair<shared_ptr<Song>, PendingLoad>> queued;   // not started yet
+    bool stopping;
+    int lookAhead;
+    shared_ptr<PlaybackTelemetry> telemetry;
+    thread worker;
+
+    void run() {
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            workAvailable.wait(lock, [this]() { return stopping || !queued.empty(); });
+            if (stopping) {
+                return;
+            }
+            shared_ptr<Song> song = queued.front().first;
+            PendingLoad result = move(queued.front().second);
+            queued.pop_front();
+            lock.unlock();
+            try {
+                result.set_value(TrackLoader::load(song, telemetry.get()));
+            } catch (...) {
+                result.set_exception(current_exception());
+            }
+            lock.lock();
+        }
+    }
+
+    bool unqueue(const shared_ptr<Song>& song) {
+        for (auto it = queued.begin(); it != queued.end(); ++it) {
+            if (it->first == song) {
+                queued.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    TrackPrefetcher(int lookAhead = 2, shared_ptr<PlaybackTelemetry> telemetry = nullptr) {
+        this->stopping = false;
+        this->lookAhead = lookAhead;
+        this->telemetry = telemetry;
+        worker = thread([this]() { run(); });
+    }
+
+    // Waits for a load already under way; queued ones are dropped.
+    ~TrackPrefetcher() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+            queued.clear();
+        }
+        workAvailable.notify_all();
+        worker.join();
+    }
+
+    TrackPrefetcher(const TrackPrefetcher&) = delete;
+    TrackPrefetcher& operator=(const TrackPrefetcher&) = delete;
+
+    int getLookAhead() const {
+        return lookAhead;
+    }
+
+    void prefetch(const vector<shared_ptr<Song>>& upcoming) {
+        lock_guard<mutex> lock(mtx);
+        // Forget loads that are no longer upcoming (queue edited, strategy changed).
+        for (auto it = inFlight.begin(); it != inFlight.end(); ) {
+            if (find(upcoming.begin(), upcoming.end(), it->first) == upcoming.end()) {
+                unqueue(it->first);
+                it = inFlight.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        bool added = false;
+        for (const shared_ptr<Song>& song : upcoming) {
+            if (inFlight.count(song)) {
+                continue;
+            }
+            PendingLoad load;
+            inFlight[song] = load.get_future().share();
+            queued.push_back({song, move(load)});
+            added = true;
+        }
+        if (added) {
+            workAvailable.notify_one();
+        }
+    }
+
+    // Returns the prefetched track (waiting if it's still loading),
+    // or nullptr if this song was never prefetched. Loads are queued in play
+    // order, so the next song is never stuck behind a later one.
+    shared_ptr<DecodedTrack> take(shared_ptr<Song> song) {
+        shared_future<shared_ptr<DecodedTrack>> pending;
+        {
+            lock_guard<mutex> lock(mtx);
+            auto it = inFlight.find(song);
+            if (it == inFlight.end()) {
+                return nullptr;
+            }
+            pending = it->second;
+            inFlight.erase(it);
+        }
+        try {
+            return pending.get();
+        } catch (const future_error&) {
+            // cleared before its turn came
+            return TrackLoader::load(song, telemetry.get());
+        }
+    }
+
+    void clear() {
+        lock_guard<mutex> lock(mtx);
+        inFlight.clear();
+        queued.clear();
+    }
+};
+
+
 /////////////////////////////////////////////////
 //          AUDIO ENGINE
 ////////////////////////////////////////////////
@@ -578,11 +1718,17 @@ mutex PlaylistManager::mtx;
 class AudioEngine {
 private:
     shared_ptr<Song> currentSong;
+    shared_ptr<DecodedTrack> currentTrack;
     bool songIsPaused;
+    bool logToConsole;
+    shared_ptr<PlaybackTelemetry> telemetry;   // may be null
 public:
-    AudioEngine() {
+    AudioEngine(bool logToConsole = true, shared_ptr<PlaybackTelemetry> telemetry = nullptr) {
         currentSong = nullptr;
+        currentTrack = nullptr;
         songIsPaused = false;
+        this->logToConsole = logToConsole;
+        this->telemetry = telemetry;
     }
     string getCurrentSongTitle() const {
         if (currentSong) {
@@ -593,22 +1739,46 @@ public:
     bool isPaused() const {
         return songIsPaused;
     }
-    void play(shared_ptr<IAudioOutputDevice> aod, shared_ptr<Song> song) {
+    // `preloaded` is the prefetched track for `song`, if any; otherwise
+    // the track is loaded here, on the caller's thread.
+    void play(shared_ptr<IAudioOutputDevice> aod, shared_ptr<Song> song,
+              shared_ptr<DecodedTrack> preloaded = nullptr) {
         if (song == nullptr) {
             throw runtime_error("Cannot play a null song.");
         }
+        auto requestedAt = chrono::steady_clock::now();
         // Resume if same song was paused
         if (songIsPaused && song == currentSong) {
             songIsPaused = false;
-            cout << "Resuming song: " << song->getTitle() << "\n";
+            if (logToConsole) {
+                cout << "Resuming song: " << song->getTitle() << "\n";
+            }
             aod->playAudio(song);
             return;
         }
 
         currentSong = song;
+        currentTrack = preloaded ? preloaded : TrackLoader::load(song, telemetry.get());
         songIsPaused = false;
-        cout << "Playing song: " << song->getTitle() << "\n";
-        aod->playAudio(song);
+        if (logToConsole) {
+            cout << "Playing song: " << song->getTitle() << (preloaded ? " (prefetched)" : "") << "\n";
+        }
+        // Time to first sample is taken by the device, when it plays the first frame.
+        aod->startTrack(song, requestedAt);
+        for (const FrameBuffer& frame : currentTrack->getLeadingFrames()) {
+            aod->writeFrame(frame);
+        }
+        currentTrack->releaseLeadingFrames();
+    }
+
+    // Sends the current track's next frame, as a device pulling audio in
+    // real time would ask for it. Returns false if nothing is playing.
+    bool streamFrame(shared_ptr<IAudioOutputDevice> aod) {
+        if (currentTrack == nullptr || songIsPaused) {
+            return false;
+        }
+        aod->writeFrame(currentTrack->decodeNextFrame());
+        return true;
     }
 
     void pause() {
@@ -619,7 +1789,9 @@ public:
             throw runtime_error("Song is already paused.");
         }
         songIsPaused = true;
-        cout << "Pausing song: " << currentSong->getTitle() << "\n";
+        if (logToConsole) {
+            cout << "Pausing song: " << currentSong->getTitle() << "\n";
+        }
     }
 };
 
@@ -636,11 +1808,30 @@ private:
     shared_ptr<AudioEngine> audioEngine;
     shared_ptr<Playlist> loadedPlaylist;
     shared_ptr<PlayStrategy> playStrategy;
+    shared_ptr<TrackPrefetcher> prefetcher;
+    shared_ptr<PlaybackTelemetry> telemetry;
+    unique_ptr<TelemetryReporter> telemetryReporter;
 
     MusicPlayerFacade() {
         loadedPlaylist = nullptr;
         playStrategy   = nullptr;
-        audioEngine = make_shared<AudioEngine>();
+        telemetry = make_shared<PlaybackTelemetry>();
+        audioEngine = make_shared<AudioEngine>(true, telemetry);
+        prefetcher = make_shared<TrackPrefetcher>(2, telemetry);
+        DeviceManager::getInstance()->setTelemetry(telemetry);
+    }
+
+    void prefetchUpcoming() {
+        prefetcher->prefetch(playStrategy->peekNext(prefetcher->getLookAhead()));
+    }
+
+    void playTrack(shared_ptr<Song> song) {
+        shared_ptr<IAudioOutputDevice> device = DeviceManager::getInstance()->getOutputDevice();
+        audioEngine->play(device, song, prefetcher->take(song));
+        device->endTrack();   // the local player has nothing past the leading frames
+        prefetchUpcoming();
+        // The next track starts once this one has played out on every device.
+        DeviceManager::getInstance()->flush();
     }
 
 public:
@@ -658,8 +1849,17 @@ public:
         DeviceManager::getInstance()->connect(deviceType);
     }
 
+    void disconnectDevice(DeviceType deviceType) {
+        DeviceManager::getInstance()->disconnect(deviceType);
+    }
+
+    void disconnectAllDevices() {
+        DeviceManager::getInstance()->disconnectAll();
+    }
+
     void setPlayStrategy(PlayStrategyType strategyType) {
         playStrategy = StrategyManager::getInstance()->getStrategy(strategyType);
+        prefetcher->clear();
     }
 
     void loadPlaylist(const string& name) {
@@ -668,6 +1868,8 @@ public:
             throw runtime_error("Play strategy not set before loading.");
         }
         playStrategy->setPlaylist(loadedPlaylist);
+        prefetcher->clear();
+        prefetchUpcoming();
     }
     
     void playSong(shared_ptr<Song> song) {
@@ -676,6 +1878,8 @@ public:
         }
         shared_ptr<IAudioOutputDevice> device = DeviceManager::getInstance()->getOutputDevice();
         audioEngine->play(device, song);
+        device->endTrack();
+        DeviceManager::getInstance()->flush();
     }
 
     void pauseSong(shared_ptr<Song> song) {
@@ -690,9 +1894,7 @@ public:
             throw runtime_error("No playlist loaded.");
         }
         while (playStrategy->hasNext()) {
-            shared_ptr<Song> nextSong = playStrategy->next();
-            shared_ptr<IAudioOutputDevice> device = DeviceManager::getInstance()->getOutputDevice();
-            audioEngine->play(device, nextSong);
+            playTrack(playStrategy->next());
         }
         cout << "Completed playlist: " << loadedPlaylist->getPlaylistName() << "\n";
     }
@@ -702,9 +1904,7 @@ public:
             throw runtime_error("No playlist loaded.");
         }
         if(playStrategy->hasNext()) {
-            shared_ptr<Song> nextSong = playStrategy->next();
-            shared_ptr<IAudioOutputDevice> device = DeviceManager::getInstance()->getOutputDevice();
-            audioEngine->play(device, nextSong);
+            playTrack(playStrategy->next());
         }
         else {
             cout << "Completed playlist: " << loadedPlaylist->getPlaylistName() << "\n";
@@ -716,9 +1916,7 @@ public:
             throw runtime_error("No playlist loaded.");
         }
         if(playStrategy->hasPrevious()) {
-            shared_ptr<Song> prevSong = playStrategy->previous();
-            shared_ptr<IAudioOutputDevice> device = DeviceManager::getInstance()->getOutputDevice();
-            audioEngine->play(device, prevSong);
+            playTrack(playStrategy->previous());
         }
         else {
             cout << "Completed playlist: " << loadedPlaylist->getPlaylistName() << "\n";
@@ -727,6 +1925,29 @@ public:
 
     void enqueueNext(shared_ptr<Song> song) {
         playStrategy->addToNext(song);
+        if (loadedPlaylist) {
+            prefetchUpcoming();
+        }
+    }
+
+    shared_ptr<PlaybackTelemetry> getTelemetry() {
+        return telemetry;
+    }
+
+    // Periodically prints the player's telemetry; a zero interval stops it.
+    void setTelemetryDumpInterval(chrono::milliseconds interval) {
+        telemetryReporter.reset();
+        if (interval.count() > 0) {
+            telemetryReporter = make_unique<TelemetryReporter>(cout, interval);
+            telemetryReporter->addSource("music player", telemetry);
+        }
+    }
+
+    void rateSong(shared_ptr<Song> song, int stars) {
+        song->setRating(stars);
+        if (playStrategy) {
+            playStrategy->onSongRated(song);
+        }
     }
 };
 
@@ -734,6 +1955,564 @@ MusicPlayerFacade* MusicPlayerFacade::instance = nullptr;
 mutex MusicPlayerFacade::mtx;
 
 
+/////////////////////////////////////////////////
+//          WORK-STEALING POOL
+////////////////////////////////////////////////
+
+// Each worker owns a deque: it pushes/pops its own work at the back and,
+// when empty, steals from the front of the others'.
+class WorkStealingPool {
+private:
+    struct WorkerQueue {
+        mutex mtx;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> workers;
+    atomic<unsigned> nextQueue;
+    atomic<long long> queued;        // sitting in some deque
+    atomic<long long> outstanding;   // submitted and not yet finished
+    atomic<int> sleeping;
+    bool stopping;
+    mutex idleMtx;
+    condition_variable workAvailable;
+    condition_variable allDone;
+
+    static thread_local WorkStealingPool* currentPool;
+    static thread_local int currentWorker;
+
+    bool tryPop(int self, function<void()>& task) {
+        int count = (int)queues.size();
+        for (int i = 0; i < count; i++) {
+            WorkerQueue& queue = *queues[(self + i) % count];
+            lock_guard<mutex> lock(queue.mtx);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                task = move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void run(int self) {
+        currentPool = this;
+        currentWorker = self;
+        while (true) {
+            function<void()> task;
+            if (tryPop(self, task)) {
+                task();
+                if (--outstanding == 0) {
+                    lock_guard<mutex> lock(idleMtx);
+                    allDone.notify_all();
+                }
+                continue;
+            }
+            unique_lock<mutex> lock(idleMtx);
+            sleeping++;
+            workAvailable.wait(lock, [this]() { return stopping || queued > 0; });
+            sleeping--;
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+    }
+
+public:
+    WorkStealingPool(int threadCount = (int)max(1u, thread::hardware_concurrency())) {
+        nextQueue = 0;
+        queued = 0;
+        outstanding = 0;
+        sleeping = 0;
+        stopping = false;
+        for (int i = 0; i < threadCount; i++) {
+            queues.push_back(make_unique<WorkerQueue>());
+        }
+        for (int i = 0; i < threadCount; i++) {
+            workers.emplace_back(&WorkStealingPool::run, this, i);
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> lock(idleMtx);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    int getThreadCount() const {
+        return (int)workers.size();
+    }
+
+    // From a worker the task goes on that worker's own deque (it's likely
+    // follow-up work on data already in cache); otherwise round-robin.
+    void submit(function<void()> task) {
+        int target = (currentPool == this) ? currentWorker
+                                           : (int)(nextQueue++ % queues.size());
+        outstanding++;
+        {
+            lock_guard<mutex> lock(queues[target]->mtx);
+            queues[target]->tasks.push_back(move(task));
+        }
+        queued++;
+        if (sleeping > 0) {
+            lock_guard<mutex> lock(idleMtx);
+            workAvailable.notify_one();
+        }
+    }
+
+    void waitIdle() {
+        unique_lock<mutex> lock(idleMtx);
+        allDone.wait(lock, [this]() { return outstanding == 0; });
+    }
+};
+
+thread_local WorkStealingPool* WorkStealingPool::currentPool = nullptr;
+thread_local int WorkStealingPool::currentWorker = -1;
+
+
+/////////////////////////////////////////////////
+//          PLAYER SESSIONS
+////////////////////////////////////////////////
+
+// Output for a remote listener: audio goes out over the network stream
+// instead of to a local device.
+class SessionStreamOutput : public IAudioOutputDevice {
+private:
+    long long tracksStarted;
+    long long framesSent;
+    shared_ptr<PlaybackTelemetry> telemetry;   // may be null
+    bool awaitingFirstSample;
+    chrono::steady_clock::time_point trackRequestedAt;
+public:
+    SessionStreamOutput(shared_ptr<PlaybackTelemetry> telemetry = nullptr) {
+        tracksStarted = 0;
+        framesSent = 0;
+        this->telemetry = telemetry;
+        awaitingFirstSample = false;
+    }
+    void playAudio(shared_ptr<Song>) override {
+        tracksStarted++;
+        // mimics sending a track-change message to the listener
+    }
+    void startTrack(shared_ptr<Song> song, chrono::steady_clock::time_point requestedAt) override {
+        playAudio(song);
+        awaitingFirstSample = true;
+        trackRequestedAt = requestedAt;
+    }
+    void writeFrame(const FrameBuffer&) override {
+        framesSent++;
+        // mimics writing the frame to the listener's stream
+        if (awaitingFirstSample && telemetry) {
+            telemetry->recordTimeToFirstSample(chrono::steady_clock::now() - trackRequestedAt);
+        }
+        awaitingFirstSample = false;
+    }
+    int getLatencyMs() const override {
+        return 0;
+    }
+    long long getTracksStarted() const {
+        return tracksStarted;
+    }
+    long long getFramesSent() const {
+        return framesSent;
+    }
+};
+
+
+// One listener's player. Unlike MusicPlayerFacade nothing here is shared:
+// strategy, engine and output are per session. Playlists are shared
+// read-only with PlaylistManager.
+class PlayerSession {
+private:
+    int sessionId;
+    mutex mtx;   // listener commands vs. playback steps on the pool
+    shared_ptr<PlayStrategy> playStrategy;
+    shared_ptr<AudioEngine> audioEngine;
+    shared_ptr<Playlist> loadedPlaylist;
+    shared_ptr<SessionStreamOutput> output;
+    shared_ptr<PlaybackTelemetry> telemetry;
+
+public:
+    PlayerSession(int id, PlayStrategyType strategyType) {
+        sessionId = id;
+        playStrategy = StrategyManager::createStrategy(strategyType);
+        telemetry = make_shared<PlaybackTelemetry>();
+        audioEngine = make_shared<AudioEngine>(false, telemetry);
+        loadedPlaylist = nullptr;
+        output = make_shared<SessionStreamOutput>(telemetry);
+    }
+
+    int getSessionId() const {
+        return sessionId;
+    }
+
+    shared_ptr<PlaybackTelemetry> getTelemetry() const {
+        return telemetry;
+    }
+
+    void setPlayStrategy(PlayStrategyType strategyType) {
+        lock_guard<mutex> lock(mtx);
+        playStrategy = StrategyManager::createStrategy(strategyType);
+        if (loadedPlaylist) {
+            playStrategy->setPlaylist(loadedPlaylist);
+        }
+    }
+
+    void loadPlaylist(shared_ptr<Playlist> playlist) {
+        lock_guard<mutex> lock(mtx);
+        loadedPlaylist = playlist;
+        playStrategy->setPlaylist(loadedPlaylist);
+    }
+
+    void enqueueNext(shared_ptr<Song> song) {
+        lock_guard<mutex> lock(mtx);
+        playStrategy->addToNext(song);
+    }
+
+    // Returns false once the playlist is finished.
+    bool playNextTrack() {
+        lock_guard<mutex> lock(mtx);
+        if (!loadedPlaylist) {
+            throw runtime_error("No playlist loaded.");
+        }
+        if (!playStrategy->hasNext()) {
+            return false;
+        }
+        audioEngine->play(output, playStrategy->next());
+        return true;
+    }
+
+    // One frame period of the current track; false if nothing is playing.
+    bool streamFrame() {
+        lock_guard<mutex> lock(mtx);
+        return audioEngine->streamFrame(output);
+    }
+
+    long long getTracksPlayed() {
+        lock_guard<mutex> lock(mtx);
+        return output->getTracksStarted();
+    }
+
+    long long getFramesSent() {
+        lock_guard<mutex> lock(mtx);
+        return output->getFramesSent();
+    }
+};
+
+
+// Hosts many PlayerSessions in one process; playback for all of them runs
+// as small tasks on one shared WorkStealingPool.
+class SessionHost {
+private:
+    WorkStealingPool pool;
+    mutex mtx;
+    unordered_map<int, shared_ptr<PlayerSession>> sessions;
+    int nextSessionId;
+
+    // A step plays one track and queues the session's next step. A real
+    // backend would queue it for when the track ends.
+    void playStep(shared_ptr<PlayerSession> session) {
+        if (session->playNextTrack()) {
+            pool.submit([this, session]() { playStep(session); });
+        }
+    }
+
+public:
+    SessionHost(int threadCount = (int)max(1u, thread::hardware_concurrency()))
+        : pool(threadCount) {
+        nextSessionId = 1;
+    }
+
+    int getThreadCount() const {
+        return pool.getThreadCount();
+    }
+
+    shared_ptr<PlayerSession> openSession(PlayStrategyType strategyType) {
+        lock_guard<mutex> lock(mtx);
+        shared_ptr<PlayerSession> session = make_shared<PlayerSession>(nextSessionId++, strategyType);
+        sessions[session->getSessionId()] = session;
+        return session;
+    }
+
+    void closeSession(int sessionId) {
+        lock_guard<mutex> lock(mtx);
+        sessions.erase(sessionId);
+    }
+
+    shared_ptr<PlayerSession> getSession(int sessionId) {
+        lock_guard<mutex> lock(mtx);
+        auto it = sessions.find(sessionId);
+        if (it == sessions.end()) {
+            throw runtime_error("Session " + to_string(sessionId) + " not found.");
+        }
+        return it->second;
+    }
+
+    void startPlayback(int sessionId) {
+        shared_ptr<PlayerSession> session = getSession(sessionId);
+        pool.submit([this, session]() { playStep(session); });
+    }
+
+    // Queues one frame of streaming for every open session. Called once
+    // per frame period, this is the host's steady-state load.
+    void streamTick() {
+        lock_guard<mutex> lock(mtx);
+        for (auto& entry : sessions) {
+            shared_ptr<PlayerSession> session = entry.second;
+            pool.submit([session]() { session->streamFrame(); });
+        }
+    }
+
+    void waitIdle() {
+        pool.waitIdle();
+    }
+};
+
+
+/////////////////////////////////////////////////
+//          SONG CATALOG
+////////////////////////////////////////////////
+
+// On-disk catalog, used in place straight from an mmap:
+//   CatalogHeader
+//   TrackRecord[trackCount]
+//   uint32_t titleIndex[trackCount]    (track ids sorted by title)
+//   char stringHeap[heapSize]          (strings are not null terminated)
+struct CatalogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t trackCount;
+    uint64_t recordsOffset;
+    uint64_t titleIndexOffset;
+    uint64_t heapOffset;
+    uint64_t heapSize;
+};
+
+struct TrackRecord {
+    uint32_t titleOffset;
+    uint32_t titleLength;
+    uint32_t artistOffset;
+    uint32_t artistLength;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+static const char CATALOG_MAGIC[8] = {'S', 'O', 'N', 'G', 'C', 'A', 'T', '1'};
+static const uint32_t CATALOG_VERSION = 1;
+
+class SongCatalog {
+private:
+    MappedFile file;
+    const CatalogHeader* header;
+    const TrackRecord* records;
+    const uint32_t* titleIndex;
+    const char* heap;
+
+    string_view heapString(uint32_t offset, uint32_t length) const {
+        return string_view(heap + offset, length);
+    }
+
+    // True if [offset, offset + length) lies inside a region of regionSize bytes.
+    static bool fits(uint64_t offset, uint64_t length, uint64_t regionSize) {
+        return offset <= regionSize && length <= regionSize - offset;
+    }
+
+public:
+    SongCatalog(const string& path) {
+        if (!file.open(path)) {
+            throw runtime_error("Cannot open song catalog \"" + path + "\".");
+        }
+        size_t size = file.getLength();
+        const char* base = file.getData();
+        if (size < sizeof(CatalogHeader)) {
+            throw runtime_error("Song catalog \"" + path + "\" is truncated.");
+        }
+        header = (const CatalogHeader*)base;
+        if (memcmp(header->magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0
+                || header->version != CATALOG_VERSION) {
+            throw runtime_error("\"" + path + "\" is not a song catalog.");
+        }
+        uint64_t count = header->trackCount;
+        if (!fits(header->recordsOffset, count * sizeof(TrackRecord), size)
+                || !fits(header->titleIndexOffset, count * sizeof(uint32_t), size)
+                || !fits(header->heapOffset, header->heapSize, size)) {
+            throw runtime_error("Song catalog \"" + path + "\" is truncated.");
+        }
+        if (header->recordsOffset % alignof(TrackRecord) != 0
+                || header->titleIndexOffset % alignof(uint32_t) != 0) {
+            throw runtime_error("Song catalog \"" + path + "\" is corrupt.");
+        }
+        records = (const TrackRecord*)(base + header->recordsOffset);
+        titleIndex = (const uint32_t*)(base + header->titleIndexOffset);
+        heap = base + header->heapOffset;
+
+        // Every string and index entry is dereferenced without further checks
+        // later on, so a bad record has to be caught here.
+        uint64_t heapSize = header->heapSize;
+        for (uint32_t id = 0; id < header->trackCount; id++) {
+            const TrackRecord& record = records[id];
+            if (!fits(record.titleOffset, record.titleLength, heapSize)
+                    || !fits(record.artistOffset, record.artistLength, heapSize)
+                    || !fits(record.pathOffset, record.pathLength, heapSize)
+                    || titleIndex[id] >= header->trackCount) {
+                throw runtime_error("Song catalog \"" + path + "\" is corrupt at track " + to_string(id) + ".");
+            }
+        }
+    }
+
+    int getTrackCount() const {
+        return (int)header->trackCount;
+    }
+    string_view getTitle(int id) const {
+        return heapString(records[id].titleOffset, records[id].titleLength);
+    }
+    string_view getArtist(int id) const {
+        return heapString(records[id].artistOffset, records[id].artistLength);
+    }
+    string_view getFilePath(int id) const {
+        return heapString(records[id].pathOffset, records[id].pathLength);
+    }
+
+    // Binary search over the prebuilt title index. Returns -1 if absent.
+    int findByTitle(string_view title) const {
+        const uint32_t* end = titleIndex + header->trackCount;
+        const uint32_t* it = lower_bound(titleIndex, end, title,
+            [this](uint32_t id, string_view t) { return getTitle(id) < t; });
+        if (it == end || getTitle(*it) != title) {
+            return -1;
+        }
+        return (int)*it;
+    }
+};
+
+
+class SongCatalogBuilder {
+private:
+    // Splits one CSV line; fields may be "quoted" and contain "" escapes.
+    static vector<string> parseCsvLine(const string& line) {
+        vector<string> fields(1);
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++) {
+            char c = line[i];
+            if (quoted) {
+                if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                    fields.back() += '"';
+                    i++;
+                } else if (c == '"') {
+                    quoted = false;
+                } else {
+                    fields.back() += c;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ',') {
+                fields.push_back("");
+            } else if (c != '\r') {
+                fields.back() += c;
+            }
+        }
+        return fields;
+    }
+
+public:
+    // Manifest rows are: title,artist,path  (an optional "title,..." header row is skipped).
+    static int buildFromCsv(const string& manifestPath, const string& catalogPath) {
+        ifstream in(manifestPath);
+        if (!in) {
+            throw runtime_error("Cannot open manifest \"" + manifestPath + "\".");
+        }
+
+        vector<TrackRecord> records;
+        string heap;
+        unordered_map<string, uint32_t> interned;   // artists and paths repeat a lot
+        auto addString = [&](const string& str) {
+            auto it = interned.find(str);
+            if (it != interned.end()) {
+                return it->second;
+            }
+            if (str.size() > UINT32_MAX - heap.size()) {
+                throw runtime_error("Manifest strings exceed the 4 GiB catalog heap.");
+            }
+            uint32_t offset = (uint32_t)heap.size();
+            heap += str;
+            interned[str] = offset;
+            return offset;
+        };
+
+        string line;
+        int lineNumber = 0;
+        while (getline(in, line)) {
+            lineNumber++;
+            if (line.empty() || line == "\r") {
+                continue;
+            }
+            vector<string> fields = parseCsvLine(line);
+            if (lineNumber == 1 && fields[0] == "title") {
+                continue;
+            }
+            if (fields.size() != 3) {
+                throw runtime_error("Manifest line " + to_string(lineNumber) + ": expected title,artist,path.");
+            }
+            if (records.size() == UINT32_MAX) {
+                throw runtime_error("Manifest has too many tracks for one catalog.");
+            }
+            TrackRecord record;
+            record.titleOffset = addString(fields[0]);
+            record.titleLength = (uint32_t)fields[0].size();
+            record.artistOffset = addString(fields[1]);
+            record.artistLength = (uint32_t)fields[1].size();
+            record.pathOffset = addString(fields[2]);
+            record.pathLength = (uint32_t)fields[2].size();
+            records.push_back(record);
+        }
+
+        vector<uint32_t> titleIndex(records.size());
+        iota(titleIndex.begin(), titleIndex.end(), 0);
+        auto titleOf = [&](uint32_t id) {
+            return string_view(heap.data() + records[id].titleOffset, records[id].titleLength);
+        };
+        stable_sort(titleIndex.begin(), titleIndex.end(),
+            [&](uint32_t a, uint32_t b) { return titleOf(a) < titleOf(b); });
+
+        CatalogHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+        header.version = CATALOG_VERSION;
+        header.trackCount = (uint32_t)records.size();
+        header.recordsOffset = sizeof(CatalogHeader);
+        header.titleIndexOffset = header.recordsOffset + records.size() * sizeof(TrackRecord);
+        header.heapOffset = header.titleIndexOffset + titleIndex.size() * sizeof(uint32_t);
+        header.heapSize = heap.size();
+
+        ofstream out(catalogPath, ios::binary | ios::trunc);
+        if (!out) {
+            throw runtime_error("Cannot write catalog \"" + catalogPath + "\".");
+        }
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)records.data(), records.size() * sizeof(TrackRecord));
+        out.write((const char*)titleIndex.data(), titleIndex.size() * sizeof(uint32_t));
+        out.write(heap.data(), heap.size());
+        if (!out) {
+            throw runtime_error("Failed writing catalog \"" + catalogPath + "\".");
+        }
+        return (int)records.size();
+    }
+};
+
+
 /////////////////////////////////////////////////
 //          MUSIC PLAYER APPLICATION
 ////////////////////////////////////////////////
@@ -743,7 +2522,11 @@ private:
     static MusicPlayerApplication* instance;
     static mutex mtx;
     vector<shared_ptr<Song>> songLibrary;
-    MusicPlayerApplication() {}
+    shared_ptr<SongCatalog> catalog;
+    unordered_map<int, shared_ptr<Song>> catalogSongs;   // catalog id -> Song, built on first use
+    MusicPlayerApplication() {
+        catalog = nullptr;
+    }
 
 public:
     static MusicPlayerApplication* getInstance() {
@@ -762,12 +2545,30 @@ public:
         songLibrary.push_back(newSong);
     }
 
+    // Catalog songs are only turned into Song objects when something asks for them.
+    void loadLibraryFromCatalog(const string& catalogPath) {
+        catalog = make_shared<SongCatalog>(catalogPath);
+        catalogSongs.clear();
+    }
+
     shared_ptr<Song> findSongByTitle(const string& title) {
         for (shared_ptr<Song> s : songLibrary) {
             if (s->getTitle() == title) {
                 return s;
             }
         }
+        if (catalog) {
+            int id = catalog->findByTitle(title);
+            if (id >= 0) {
+                shared_ptr<Song>& song = catalogSongs[id];
+                if (!song) {
+                    song = make_shared<Song>(string(catalog->getTitle(id)),
+                                             string(catalog->getArtist(id)),
+                                             string(catalog->getFilePath(id)));
+                }
+                return song;
+            }
+        }
         return nullptr;
     }
     void createPlaylist(const string& playlistName) {
@@ -788,6 +2589,14 @@ public:
         MusicPlayerFacade::getInstance()->connectDevice(deviceType);
     }
 
+    void disconnectAudioDevice(DeviceType deviceType) {
+        MusicPlayerFacade::getInstance()->disconnectDevice(deviceType);
+    }
+
+    void disconnectAllAudioDevices() {
+        MusicPlayerFacade::getInstance()->disconnectAllDevices();
+    }
+
     void selectPlayStrategy(PlayStrategyType strategyType) {
         MusicPlayerFacade::getInstance()->setPlayStrategy(strategyType);
     }
@@ -827,20 +2636,154 @@ public:
         }
         MusicPlayerFacade::getInstance()->enqueueNext(song);
     }
+
+    void printPlaybackTelemetry() {
+        cout << "[Telemetry] music player\n";
+        MusicPlayerFacade::getInstance()->getTelemetry()->dumpText(cout);
+    }
+
+    void setTelemetryDumpInterval(chrono::milliseconds interval) {
+        MusicPlayerFacade::getInstance()->setTelemetryDumpInterval(interval);
+    }
+
+    void rateSong(const string& songTitle, int stars) {
+        shared_ptr<Song> song = findSongByTitle(songTitle);
+        if (!song) {
+            throw runtime_error("Song \"" + songTitle + "\" not found.");
+        }
+        MusicPlayerFacade::getInstance()->rateSong(song, stars);
+    }
 };
 
 MusicPlayerApplication* MusicPlayerApplication::instance = nullptr;
 mutex MusicPlayerApplication::mtx;
 
 
+/////////////////////////////////////////////////
+//          SESSION BENCHMARK
+////////////////////////////////////////////////
+
+static long long residentMemoryBytes() {
+    long long pages = 0, residentPages = 0;
+    ifstream statm("/proc/self/statm");
+    statm >> pages >> residentPages;
+    return residentPages * sysconf(_SC_PAGESIZE);
+}
+
+static double processCpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+         + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// MusicPlayerSystem --bench-sessions [sessions] [tracksPerSession]
+void runSessionBenchmark(int sessionCount, int tracksPerSession) {
+    shared_ptr<Playlist> playlist = make_shared<Playlist>("Benchmark Mix");
+    for (int i = 0; i < tracksPerSession; i++) {
+        playlist->addSongToPlaylist(make_shared<Song>("Track " + to_string(i), "Artist " + to_string(i % 7),
+                                                      "/music/track_" + to_string(i) + ".mp3"));
+    }
+
+    SessionHost host;
+    vector<int> sessionIds;
+    long long memoryBefore = residentMemoryBytes();
+    for (int i = 0; i < sessionCount; i++) {
+        PlayStrategyType type = (i % 2 == 0) ? PlayStrategyType::SEQUENTIAL : PlayStrategyType::RANDOM;
+        shared_ptr<PlayerSession> session = host.openSession(type);
+        session->loadPlaylist(playlist);
+        sessionIds.push_back(session->getSessionId());
+    }
+    long long memoryIdle = residentMemoryBytes();
+
+    auto start = chrono::steady_clock::now();
+    for (int id : sessionIds) {
+        host.startPlayback(id);
+    }
+    host.waitIdle();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    long long memoryPlayed = residentMemoryBytes();
+
+    long long tracksPlayed = 0;
+    for (int id : sessionIds) {
+        tracksPlayed += host.getSession(id)->getTracksPlayed();
+    }
+    int cores = host.getThreadCount();
+    double tracksPerSecondPerCore = tracksPlayed / seconds / cores;
+
+    // Steady state: every session streams its current track one frame per
+    // frame period, paced in real time on the same pool.
+    auto framePeriod = chrono::microseconds(1000000LL * DecodedTrack::SAMPLES_PER_FRAME / SAMPLE_RATE_HZ);
+    const int streamTicks = 100;
+    int lateTicks = 0;
+    long long framesBefore = 0;
+    for (int id : sessionIds) {
+        framesBefore += host.getSession(id)->getFramesSent();
+    }
+    double cpuBefore = processCpuSeconds();
+    auto tickAt = chrono::steady_clock::now();
+    for (int t = 0; t < streamTicks; t++) {
+        host.streamTick();
+        host.waitIdle();
+        tickAt += framePeriod;
+        if (chrono::steady_clock::now() > tickAt) {
+            lateTicks++;
+        } else {
+            this_thread::sleep_until(tickAt);
+        }
+    }
+    double streamCpuSeconds = processCpuSeconds() - cpuBefore;
+    long long framesStreamed = -framesBefore;
+    for (int id : sessionIds) {
+        framesStreamed += host.getSession(id)->getFramesSent();
+    }
+    double audioSeconds = framesStreamed * chrono::duration<double>(framePeriod).count();
+    // CPU seconds spent per second of audio streamed to one listener.
+    double coreShare = streamCpuSeconds / max(1e-9, audioSeconds);
+
+    cout << "Sessions:                " << sessionCount << " on " << cores << " worker threads\n";
+    cout << "Tracks played:           " << tracksPlayed << " in " << fixed << setprecision(3) << seconds << " s\n";
+    cout << "Track starts/s per core: " << setprecision(0) << tracksPerSecondPerCore << "\n";
+    cout << "Memory per session:      ~" << (memoryIdle - memoryBefore) / max(1, sessionCount) << " bytes idle, ~"
+         << (memoryPlayed - memoryBefore) / max(1, sessionCount) << " bytes after playback\n";
+    cout << "Streaming CPU:           " << setprecision(1) << coreShare * 1e6 << " us per second of audio per session\n";
+    cout << "Sessions per core:       ~" << setprecision(0) << 1 / max(1e-12, coreShare)
+         << " (streaming " << streamTicks << " frame periods";
+    if (lateTicks > 0) {
+        cout << ", host fell behind on " << lateTicks;
+    }
+    cout << ")\n";
+    cout << "[Telemetry] session " << sessionIds.front() << "\n";
+    host.getSession(sessionIds.front())->getTelemetry()->dumpText(cout);
+}
+
+
 /////////////////////////////////////////////////
 //          MAIN
 ////////////////////////////////////////////////
 
-int main() {
+int main(int argc, char* argv[]) {
     try {
+        // Catalog builder tool: MusicPlayerSystem --build-catalog <manifest.csv> <catalog.bin>
+        if (argc == 4 && string(argv[1]) == "--build-catalog") {
+            int count = SongCatalogBuilder::buildFromCsv(argv[2], argv[3]);
+            cout << "Wrote " << count << " tracks to " << argv[3] << "\n";
+            return 0;
+        }
+
+        if (argc >= 2 && string(argv[1]) == "--bench-sessions") {
+            runSessionBenchmark(argc >= 3 ? stoi(argv[2]) : 10000, argc >= 4 ? stoi(argv[3]) : 20);
+            return 0;
+        }
+
         auto application = MusicPlayerApplication::getInstance();
 
+        // MusicPlayerSystem --catalog <catalog.bin> adds a prebuilt catalog to the library
+        if (argc == 3 && string(argv[1]) == "--catalog") {
+            application->loadLibraryFromCatalog(argv[2]);
+        }
+
         // Populate library
         application->createSongInLibrary("Kesariya",  "Arijit Singh",  "/music/kesariya.mp3");
         application->createSongInLibrary("Chaiyya Chaiyya",   "Sukhwinder Singh",  "/music/chaiyya_chaiyya.mp3");
@@ -888,6 +2831,25 @@ int main() {
         application->playPreviousTrackInPlaylist();
         application->playPreviousTrackInPlaylist();
 
+        cout << "\n-- Smart Shuffle Playback --\n";
+        application->rateSong("Jai Ho", 5);
+        application->rateSong("Chaiyya Chaiyya", 1);
+        application->selectPlayStrategy(PlayStrategyType::SMART_SHUFFLE);
+        application->loadPlaylist("Bollywood Vibes");
+        application->playAllTracksInPlaylist();
+
+        cout << "\n-- Multiple Devices --\n";
+        application->connectAudioDevice(DeviceType::WIRED);
+        application->connectAudioDevice(DeviceType::HEADPHONES);
+        application->playSingleSong("Jai Ho");
+        application->disconnectAudioDevice(DeviceType::HEADPHONES);
+        application->playSingleSong("Kesariya");
+
+        application->disconnectAllAudioDevices();
+
+        cout << "\n-- Playback Telemetry --\n";
+        application->printPlaybackTelemetry();
+
     } catch (const exception& error) {
         cerr << "Error: " << error.what() << endl;
     }
@@ -35,82 +35,329 @@ PATTERNS USED TO SOLVE THIS PROBLEM
 //////////////////////////////////////////////////////////////////
 
 #include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 using namespace std;
 
 //////////////////////////////////////////////////////////////////
 //                PRODUCT
 //////////////////////////////////////////////////////////////////
 
+// Immutable once built: the catalog hands out one shared instance per SKU.
 class Product {
 private:
-	string name;
-	double price;
-	int sku;
+	const string name;
+	const string category;
+	const double price;
+	const int sku;
 public:
-	Product(int id, string name, double price){
-		this->sku = id;
-		this->name = name;
-		this->price = price;
+	Product(int id, string name, double price, string category = "General")
+		: name(move(name)), category(move(category)), price(price), sku(id) {}
+
+	const string& getName() const { return name;}
+	const string& getCategory() const { return category;}
+	double getPrice() const {return price;}
+	int getSku() const {return sku;}
+};
+
+//////////////////////////////////////////////////////////////////
+//                PRODUCT CATALOG
+//////////////////////////////////////////////////////////////////
+
+// Read-only SKU -> Product index, built once per catalog load.
+//   - SKUs packed into a narrow range: a dense array indexed by sku - minSku
+//   - otherwise: a perfect hash (hash and displace). Each key hashes to a
+//     bucket, and each bucket stores the seed that sends all of its keys to
+//     free slots, so a lookup is two hashes and one compare.
+// Lookups never allocate or lock.
+class CatalogIndex {
+private:
+	bool dense;
+	int minSku;
+	vector<int> keys;                       // slot -> sku, or -1 when empty
+	vector<shared_ptr<Product>> products;   // slot -> product
+	vector<uint32_t> seeds;                 // bucket -> displacement seed
+
+	static uint32_t mix(int sku, uint32_t seed) {
+		uint64_t h = (uint64_t)(uint32_t)sku * 0x9E3779B97F4A7C15ull ^ ((uint64_t)seed * 0xC2B2AE3D27D4EB4Full);
+		h ^= h >> 31;
+		h *= 0xBF58476D1CE4E5B9ull;
+		h ^= h >> 29;
+		return (uint32_t)h;
+	}
+
+	bool buildPerfectHash(const vector<shared_ptr<Product>>& items, size_t slotCount) {
+		size_t bucketCount = items.size() / 4 + 1;
+		vector<vector<int>> buckets(bucketCount);
+		for (size_t i = 0; i < items.size(); i++) {
+			buckets[mix(items[i]->getSku(), 0) % bucketCount].push_back((int)i);
+		}
+		vector<size_t> order(bucketCount);
+		iota(order.begin(), order.end(), 0);
+		sort(order.begin(), order.end(), [&](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+		keys.assign(slotCount, -1);
+		products.assign(slotCount, nullptr);
+		seeds.assign(bucketCount, 0);
+		vector<size_t> slots;
+		for (size_t b : order) {
+			if (buckets[b].empty()) break;
+			bool placed = false;
+			for (uint32_t seed = 1; seed < (1u << 20) && !placed; seed++) {
+				slots.clear();
+				placed = true;
+				for (int i : buckets[b]) {
+					size_t slot = mix(items[i]->getSku(), seed) % slotCount;
+					if (keys[slot] != -1 || std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+						placed = false;
+						break;
+					}
+					slots.push_back(slot);
+				}
+				if (placed) {
+					seeds[b] = seed;
+					for (size_t k = 0; k < slots.size(); k++) {
+						keys[slots[k]] = items[buckets[b][k]]->getSku();
+						products[slots[k]] = items[buckets[b][k]];
+					}
+				}
+			}
+			if (!placed) return false;
+		}
+		return true;
+	}
+
+public:
+	// `items` must have distinct SKUs.
+	explicit CatalogIndex(const vector<shared_ptr<Product>>& items) {
+		minSku = 0;
+		int maxSku = -1;
+		if (!items.empty()) {
+			minSku = items[0]->getSku();
+			maxSku = minSku;
+			for (const shared_ptr<Product>& p : items) {
+				minSku = min(minSku, p->getSku());
+				maxSku = max(maxSku, p->getSku());
+			}
+		}
+		long long span = (long long)maxSku - minSku + 1;
+		dense = span <= 2 * (long long)items.size() + 64;
+		if (dense) {
+			keys.assign(span, -1);
+			products.assign(span, nullptr);
+			for (const shared_ptr<Product>& p : items) {
+				keys[p->getSku() - minSku] = p->getSku();
+				products[p->getSku() - minSku] = p;
+			}
+			return;
+		}
+		size_t slotCount = items.size() + items.size() / 4 + 1;
+		while (!buildPerfectHash(items, slotCount)) slotCount += slotCount / 4 + 1;
+	}
+
+	const shared_ptr<Product>* find(int sku) const {
+		size_t slot;
+		if (dense) {
+			if (sku < minSku || (size_t)(sku - minSku) >= keys.size()) return nullptr;
+			slot = sku - minSku;
+		} else {
+			slot = mix(sku, seeds[mix(sku, 0) % seeds.size()]) % keys.size();
+		}
+		return keys[slot] == sku ? &products[slot] : nullptr;
 	}
 
-	string getName() { return name;}
-	double getPrice() {return price;}
-	int getSku() {return sku;}
+	size_t size() const {
+		size_t n = 0;
+		for (int k : keys) n += (k != -1);
+		return n;
+	}
+
+	bool isDense() const { return dense; }
 };
 
-class ProductFactory {
+// Singleton
+// Owns the interned Product for every SKU. A catalog file replaces the
+// built-in one wholesale; readers keep using whichever index they loaded,
+// and retired indexes are kept so handles into them stay valid.
+// SKUs missing from the catalog are interned once in an overflow map.
+class ProductCatalog {
+private:
+	atomic<const CatalogIndex*> index;
+	vector<unique_ptr<CatalogIndex>> retired;
+	mutex loadMtx;
+
+	unordered_map<int, shared_ptr<Product>> overflow;
+	mutex overflowMtx;
+
+	static ProductCatalog* instance;
+	static mutex mtx;
+
+	ProductCatalog() {
+		vector<shared_ptr<Product>> builtIn = {
+			make_shared<Product>(101, "Apple", 20, "Fruits"),
+			make_shared<Product>(102, "Banana", 10, "Fruits"),
+			make_shared<Product>(103, "Chocolate", 50, "Snacks"),
+			make_shared<Product>(201, "T-Shirt", 500, "Apparel"),
+			make_shared<Product>(202, "Jeans", 1000, "Apparel")
+		};
+		retired.push_back(make_unique<CatalogIndex>(builtIn));
+		index.store(retired.back().get());
+	}
+
 public:
-	static shared_ptr<Product> createProduct(int sku) {
-		string name;
-        double price;
+	static ProductCatalog* getInstance() {
+		if(instance == nullptr) {
+			lock_guard<mutex> lock(mtx);
+			if(instance == nullptr){
+				instance = new ProductCatalog();
+			}
+		}
+		return instance;
+	}
 
-        if (sku == 101) {
-            name  = "Apple";
-            price = 20;
-        }
-        else if (sku == 102) {
-            name  = "Banana";
-            price = 10;
-        }
-        else if (sku == 103) {
-            name  = "Chocolate";
-            price = 50;
-        }
-        else if (sku == 201) {
-            name  = "T-Shirt";
-            price = 500;
-        }
-        else if (sku == 202) {
-            name  = "Jeans";
-            price = 1000;
-        }
-        else {
-            name  = "Item" + to_string(sku);
-            price = 100;
-        }
+	void load(const vector<shared_ptr<Product>>& items) {
+		unordered_map<int, shared_ptr<Product>> unique;
+		for (const shared_ptr<Product>& p : items) unique[p->getSku()] = p;   // last one wins
+		vector<shared_ptr<Product>> distinct;
+		for (auto& [sku, p] : unique) distinct.push_back(p);
+
+		lock_guard<mutex> lock(loadMtx);
+		retired.push_back(make_unique<CatalogIndex>(distinct));
+		index.store(retired.back().get());
+	}
+
+	// One product per line: sku,name,category,price
+	// Blank lines, '#' comments and a leading "sku,..." header are skipped.
+	void loadFromFile(const string& path) {
+		ifstream in(path);
+		if (!in) throw runtime_error("Cannot open product catalog " + path);
+		vector<shared_ptr<Product>> items;
+		string line;
+		int lineNo = 0;
+		while (getline(in, line)) {
+			lineNo++;
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			if (line.empty() || line[0] == '#' || (lineNo == 1 && line.rfind("sku", 0) == 0)) continue;
+			vector<string> fields;
+			stringstream ss(line);
+			string field;
+			while (getline(ss, field, ',')) fields.push_back(field);
+			if (fields.size() != 4) {
+				throw runtime_error(path + ":" + to_string(lineNo) + ": expected sku,name,category,price");
+			}
+			try {
+				items.push_back(make_shared<Product>(stoi(fields[0]), fields[1], stod(fields[3]), fields[2]));
+			} catch (const logic_error&) {
+				throw runtime_error(path + ":" + to_string(lineNo) + ": bad sku or price");
+			}
+		}
+		load(items);
+	}
+
+	// Allocation-free; nullptr if the SKU is not in the catalog.
+	const Product* find(int sku) const {
+		const shared_ptr<Product>* p = index.load(memory_order_acquire)->find(sku);
+		return p ? p->get() : nullptr;
+	}
 
-		return make_shared<Product>(sku, name, price);
+	// The interned product. Unknown SKUs get a placeholder, created once.
+	shared_ptr<Product> get(int sku) {
+		const shared_ptr<Product>* p = index.load(memory_order_acquire)->find(sku);
+		if (p) return *p;
+		lock_guard<mutex> lock(overflowMtx);
+		shared_ptr<Product>& placeholder = overflow[sku];
+		if (!placeholder) placeholder = make_shared<Product>(sku, "Item" + to_string(sku), 100);
+		return placeholder;
+	}
+
+	size_t size() const {
+		return index.load(memory_order_acquire)->size();
 	}
 };
 
+ProductCatalog* ProductCatalog::instance = nullptr;
+mutex ProductCatalog::mtx;
+
+class ProductFactory {
+public:
+	static shared_ptr<Product> createProduct(int sku) {
+		return ProductCatalog::getInstance()->get(sku);
+	}
+};
 
 //////////////////////////////////////////////////////////////////
 //         INVENTORY STORE AND DBINVENTORTY STORE
 //////////////////////////////////////////////////////////////////
 
+// Told when a SKU's available stock first drops below the store's
+// low-stock threshold. Fires again only after stock for that SKU is back at
+// or above the threshold, by a restock or a released hold.
+class StockListener {
+public:
+	virtual ~StockListener() {}
+	virtual void onLowStock(int sku, int available) = 0;
+};
+
+// Told the exact change in a SKU's available stock, on every change, along
+// with what was available right after it.
+// Called inline on the order path, so implementations must be cheap.
+class StockObserver {
+public:
+	virtual ~StockObserver() {}
+	virtual void onStockDelta(int sku, int delta, int available) = 0;
+};
+
 class InventoryStore {
+protected:
+	int lowStockThreshold = 0;   // 0: never report
+	weak_ptr<StockListener> stockListener;
+	vector<shared_ptr<StockObserver>> stockObservers;
+
+	void stockMoved(int sku, int delta, int available) {
+		if (delta == 0) return;
+		for (shared_ptr<StockObserver>& observer : stockObservers) observer->onStockDelta(sku, delta, available);
+	}
+
+	void reportLowStock(int sku, int available) {
+		if (shared_ptr<StockListener> listener = stockListener.lock()) {
+			listener->onLowStock(sku, available);
+		}
+	}
+
 public:
 	virtual ~InventoryStore() {}
+
+	// Set up before the store is shared between threads.
+	virtual void watchLowStock(int threshold, weak_ptr<StockListener> listener) {
+		lowStockThreshold = threshold;
+		stockListener = listener;
+	}
+
+	// Adds an observer. Set up before the store is shared between threads.
+	virtual void observeStock(shared_ptr<StockObserver> observer) {
+		stockObservers.push_back(observer);
+	}
+
 	virtual void addProduct(shared_ptr<Product> prod, int quantity) = 0;
 	virtual void removeProduct(int sku, int quantity) = 0;
 	virtual int checkStock(int sku) = 0;
 	virtual vector<shared_ptr<Product>> listProduct() = 0;
+
+	// Two-step removal: reserve holds stock back from everyone else,
+	// commit takes the held stock out for good, release puts it back.
+	virtual bool reserve(int sku, int quantity) = 0;
+	virtual void commitReserved(int sku, int quantity) = 0;
+	virtual void releaseReserved(int sku, int quantity) = 0;
 };
 
+// Not thread safe: callers must serialize access.
 class DbInventoryStore : public InventoryStore {
 private:
 	unordered_map<int,int> stocks;
+	unordered_map<int,int> reserved;
 	unordered_map<int, shared_ptr<Product>>products;
+	unordered_set<int> reportedLow;   // SKUs reported and not yet back at the threshold
 
 public:
 	DbInventoryStore(){}
@@ -121,6 +368,8 @@ public:
             products[sku] = prod;
         }
         stocks[sku] += qty;
+        reportedLow.erase(sku);
+        stockMoved(sku, qty, stocks[sku]);
 	}
 
 	void removeProduct(int sku, int qty) override {
@@ -133,6 +382,10 @@ public:
         } else {
             stocks.erase(sku);
         }
+        stockMoved(sku, -(currentQuantity - max(0, remainingQuantity)), max(0, remainingQuantity));
+        if (remainingQuantity < lowStockThreshold && reportedLow.insert(sku).second) {
+            reportLowStock(sku, max(0, remainingQuantity));
+        }
 	}
 
 	int checkStock(int sku) override {
@@ -154,6 +407,617 @@ public:
 
 		return available;
 	}
+
+	bool reserve(int sku, int qty) override {
+		if (checkStock(sku) < qty) return false;
+		removeProduct(sku, qty);
+		reserved[sku] += qty;
+		return true;
+	}
+
+	void commitReserved(int sku, int qty) override {
+		reserved[sku] -= qty;
+	}
+
+	void releaseReserved(int sku, int qty) override {
+		reserved[sku] -= qty;
+		stocks[sku] += qty;
+		if (stocks[sku] >= lowStockThreshold) reportedLow.erase(sku);
+		stockMoved(sku, qty, stocks[sku]);
+	}
+};
+
+
+// Thread-safe store for many concurrent orders. Each SKU's counts are
+// atomics, so reserving stock is a compare-and-swap on that SKU alone.
+// Finding a SKU takes no lock either: slots live in an open-addressing
+// table that readers probe directly. Only adding a brand-new SKU locks,
+// and a full table is replaced by a bigger copy while readers carry on.
+class ConcurrentInventoryStore : public InventoryStore {
+private:
+	struct SkuStock {
+		int sku;
+		atomic<int> available{0};
+		atomic<int> reserved{0};
+		atomic<int> onHand{0};             // available + reserved, kept as one counter
+		atomic<bool> reportedLow{false};   // reported and not yet back at the threshold
+		shared_ptr<Product> product;
+	};
+
+	struct SkuTable {
+		size_t mask;
+		unique_ptr<atomic<SkuStock*>[]> slots;
+		SkuTable(size_t capacity) {
+			mask = capacity - 1;
+			slots = make_unique<atomic<SkuStock*>[]>(capacity);
+			for (size_t i = 0; i < capacity; i++) slots[i].store(nullptr);
+		}
+	};
+
+	atomic<SkuTable*> table;
+	vector<unique_ptr<SkuTable>> tables;     // old tables stay alive for readers still probing them
+	vector<unique_ptr<SkuStock>> allStocks;  // slots are never erased
+	mutex writeMtx;
+
+	// Healthy stock costs one compare; the exchange only runs below the threshold.
+	void stockDropped(SkuStock* slot, int available) {
+		if (available < lowStockThreshold && !slot->reportedLow.exchange(true)) {
+			reportLowStock(slot->sku, available);
+		}
+	}
+
+	static size_t slotOf(int sku, size_t mask) {
+		return ((uint32_t)sku * 2654435761u) & mask;
+	}
+
+	static void place(SkuTable* t, SkuStock* stock) {
+		size_t i = slotOf(stock->sku, t->mask);
+		while (t->slots[i].load(memory_order_relaxed)) i = (i + 1) & t->mask;
+		t->slots[i].store(stock, memory_order_release);
+	}
+
+	SkuStock* find(int sku) {
+		SkuTable* t = table.load(memory_order_acquire);
+		for (size_t i = slotOf(sku, t->mask); ; i = (i + 1) & t->mask) {
+			SkuStock* stock = t->slots[i].load(memory_order_acquire);
+			if (!stock || stock->sku == sku) return stock;
+		}
+	}
+
+	SkuStock* findOrCreate(shared_ptr<Product> prod) {
+		SkuStock* stock = find(prod->getSku());
+		if (stock) return stock;
+
+		lock_guard<mutex> lock(writeMtx);
+		stock = find(prod->getSku());
+		if (stock) return stock;
+
+		allStocks.push_back(make_unique<SkuStock>());
+		stock = allStocks.back().get();
+		stock->sku = prod->getSku();
+		stock->product = prod;
+
+		SkuTable* current = table.load(memory_order_relaxed);
+		if (allStocks.size() * 2 > current->mask + 1) {   // keep the load factor under 1/2
+			tables.push_back(make_unique<SkuTable>((current->mask + 1) * 2));
+			SkuTable* bigger = tables.back().get();
+			for (unique_ptr<SkuStock>& existing : allStocks) place(bigger, existing.get());
+			table.store(bigger, memory_order_release);
+		} else {
+			place(current, stock);
+		}
+		return stock;
+	}
+
+public:
+	ConcurrentInventoryStore(){
+		tables.push_back(make_unique<SkuTable>(64));
+		table.store(tables.back().get());
+	}
+
+	void addProduct(shared_ptr<Product> prod, int qty) override {
+		SkuStock* slot = findOrCreate(prod);
+		int available = slot->available.fetch_add(qty) + qty;
+		slot->onHand.fetch_add(qty);
+		slot->reportedLow.store(false);
+		stockMoved(slot->sku, qty, available);
+	}
+
+	void removeProduct(int sku, int qty) override {
+		removeUpTo(sku, qty);
+	}
+
+	// Like removeProduct, but says how much was actually there to remove.
+	int removeUpTo(int sku, int qty) {
+		SkuStock* slot = find(sku);
+		if (!slot) return 0;
+		int current = slot->available.load();
+		while (!slot->available.compare_exchange_weak(current, max(0, current - qty))) {
+		}
+		slot->onHand.fetch_sub(current - max(0, current - qty));
+		stockDropped(slot, max(0, current - qty));
+		stockMoved(sku, -(current - max(0, current - qty)), max(0, current - qty));
+		return current - max(0, current - qty);
+	}
+
+	int checkStock(int sku) override {
+		SkuStock* slot = find(sku);
+		return slot ? slot->available.load() : 0;
+	}
+
+	vector<shared_ptr<Product>> listProduct() override {
+		vector<shared_ptr<Product>> available;
+		lock_guard<mutex> lock(writeMtx);
+		for (unique_ptr<SkuStock>& stock : allStocks) {
+			if (stock->available.load() > 0) {
+				available.push_back(stock->product);
+			}
+		}
+		return available;
+	}
+
+	bool reserve(int sku, int qty) override {
+		SkuStock* slot = find(sku);
+		if (!slot) return false;
+		int current = slot->available.load();
+		while (current >= qty) {
+			if (slot->available.compare_exchange_weak(current, current - qty)) {
+				slot->reserved.fetch_add(qty);
+				stockDropped(slot, current - qty);
+				stockMoved(sku, -qty, current - qty);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void commitReserved(int sku, int qty) override {
+		SkuStock* slot = find(sku);
+		if (!slot) return;
+		slot->reserved.fetch_sub(qty);
+		slot->onHand.fetch_sub(qty);
+	}
+
+	void releaseReserved(int sku, int qty) override {
+		SkuStock* slot = find(sku);
+		if (!slot) return;
+		slot->reserved.fetch_sub(qty);
+		int available = slot->available.fetch_add(qty) + qty;
+		if (available >= lowStockThreshold) slot->reportedLow.store(false);
+		stockMoved(sku, qty, available);
+	}
+
+	int reservedStock(int sku) {
+		SkuStock* slot = find(sku);
+		return slot ? slot->reserved.load() : 0;
+	}
+
+	// fn(sku, onHand) for every SKU the store has seen, where onHand is
+	// available plus held stock. Reserving and releasing don't change it, so
+	// it holds still while holds come and go.
+	void forEachSku(const function<void(int,int)>& fn) {
+		lock_guard<mutex> lock(writeMtx);
+		for (unique_ptr<SkuStock>& stock : allStocks) {
+			fn(stock->sku, stock->onHand.load());
+		}
+	}
+};
+
+
+//////////////////////////////////////////////////////////////////
+//         DURABLE INVENTORY STORE (WAL + SNAPSHOTS)
+//////////////////////////////////////////////////////////////////
+
+enum class Durability {
+	GROUP_COMMIT,   // a change returns once its log record is on disk
+	ASYNC           // returns at once; the log is synced every few ms
+};
+
+// Keeps stock in a ConcurrentInventoryStore and survives restarts through
+// files in `dir`:
+//   - every change that outlives a restart (add, remove, commit) is logged
+//     as a fixed-size delta record. Deltas commute, so replay order doesn't
+//     matter. Reserve/release aren't logged: holds die with the process.
+//   - one flusher thread writes and fdatasyncs everything queued since its
+//     last write (group commit), then wakes the callers that batch covered
+//   - every `snapshotEvery` records the log is rotated, the counts go to
+//     snapshot.bin and older log segments are deleted. Only the flusher
+//     thread touches the files; snapshot() asks it and waits
+//   - a failed write or sync stops the flusher. Every change after that
+//     throws, as does any caller still waiting for its record to be durable
+// Recovery loads the snapshot and replays the newer segments in parallel:
+// chunks of each segment are parsed concurrently into per-SKU-range deltas,
+// then every range is folded in by its own thread. Stock that was held at
+// the crash counts as available again.
+class DurableInventoryStore : public InventoryStore {
+private:
+	enum WalOp : uint8_t { ADD = 1, REMOVE = 2, COMMIT = 3 };
+
+	struct WalRecord {
+		int32_t sku;
+		int32_t qty;
+		uint8_t op;
+		uint8_t pad[3];
+		uint32_t check;   // catches a torn write at the end of a segment
+	};
+
+	struct SnapshotHeader {
+		char magic[8];
+		uint64_t walSeq;   // covers every segment before this one
+		uint64_t count;
+	};
+
+	struct SnapshotEntry {
+		int32_t sku;
+		int32_t available;
+	};
+
+	static constexpr chrono::milliseconds ASYNC_FLUSH_INTERVAL = chrono::milliseconds(5);
+
+	string dir;
+	Durability durability;
+	uint64_t snapshotEvery;
+	ConcurrentInventoryStore memory;
+
+	// Guards the queue, the current segment and the apply-then-log step.
+	mutex logMtx;
+	condition_variable logCv;
+	vector<WalRecord> queued;
+	uint64_t nextLsn = 1;
+	uint64_t segmentSeq = 0;
+	int segmentFd = -1;
+	uint64_t recordsInSegment = 0;
+	bool stopping = false;
+
+	uint64_t checkpointsRequested = 0;   // by snapshot()
+	uint64_t checkpointsDone = 0;
+	condition_variable checkpointCv;
+
+	mutex durableMtx;
+	condition_variable durableCv;
+	uint64_t durableLsn = 0;
+
+	atomic<bool> failed{false};
+	exception_ptr failure;   // set once, just before `failed`
+
+	thread flusher;
+
+	static uint32_t checksum(const WalRecord& r) {
+		uint32_t h = 2166136261u;
+		for (uint32_t v : { (uint32_t)r.sku, (uint32_t)r.qty, (uint32_t)r.op }) {
+			h = (h ^ v) * 16777619u;
+		}
+		return h ^ 0x5EEDu;
+	}
+
+	string segmentPath(uint64_t seq) const {
+		return dir + "/wal." + to_string(seq) + ".log";
+	}
+
+	static void writeAll(int fd, const void* data, size_t bytes) {
+		const char* p = (const char*)data;
+		while (bytes > 0) {
+			ssize_t n = ::write(fd, p, bytes);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) throw runtime_error("Inventory WAL write failed");
+			p += n;
+			bytes -= n;
+		}
+	}
+
+	static void sync(int fd, const string& what) {
+		if (fdatasync(fd) != 0) throw runtime_error("Cannot sync " + what + ": " + strerror(errno));
+	}
+
+	void throwIfFailed() {
+		if (failed.load(memory_order_acquire)) {
+			try {
+				rethrow_exception(failure);
+			} catch (const exception& e) {
+				throw runtime_error(string("Inventory WAL is down: ") + e.what());
+			}
+		}
+	}
+
+	// Called on the flusher thread, which then stops.
+	void fail(exception_ptr error) {
+		{
+			scoped_lock lock(logMtx, durableMtx);   // both sets of waiters check `failed`
+			failure = error;
+			failed.store(true, memory_order_release);
+		}
+		durableCv.notify_all();
+		checkpointCv.notify_all();
+	}
+
+	int openSegment(uint64_t seq) {
+		int fd = ::open(segmentPath(seq).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd < 0) throw runtime_error("Cannot open inventory WAL " + segmentPath(seq));
+		return fd;
+	}
+
+	// Applies a change and queues its record under one lock, so the log
+	// order is the apply order and a snapshot never sees half a change.
+	// Throws if the log has failed; in GROUP_COMMIT mode a change already
+	// applied in memory can still throw if the log fails before it's synced.
+	void logged(WalOp op, int sku, const function<int()>& apply) {
+		uint64_t lsn;
+		{
+			lock_guard<mutex> lock(logMtx);
+			throwIfFailed();
+			int qty = apply();   // what was actually changed
+			if (qty <= 0 && op != ADD) return;
+			WalRecord r{sku, qty, op, {0, 0, 0}, 0};
+			r.check = checksum(r);
+			queued.push_back(r);
+			lsn = nextLsn++;
+			if (durability == Durability::GROUP_COMMIT && queued.size() == 1) logCv.notify_one();
+		}
+		if (durability == Durability::GROUP_COMMIT) {
+			unique_lock<mutex> lock(durableMtx);
+			durableCv.wait(lock, [&]() { return durableLsn >= lsn || failed.load(); });
+			if (durableLsn < lsn) throwIfFailed();
+		}
+	}
+
+	void publishDurable(uint64_t lsn) {
+		{
+			lock_guard<mutex> lock(durableMtx);
+			durableLsn = max(durableLsn, lsn);
+		}
+		durableCv.notify_all();
+	}
+
+	void flushLoop() {
+		try {
+			flushUntilStopped();
+		} catch (...) {
+			fail(current_exception());
+		}
+	}
+
+	void flushUntilStopped() {
+		while (true) {
+			vector<WalRecord> batch;
+			uint64_t upTo, serving;
+			int fd;
+			bool snapshotDue, stop;
+			{
+				unique_lock<mutex> lock(logMtx);
+				auto woken = [&]() { return stopping || checkpointsRequested > checkpointsDone; };
+				if (durability == Durability::GROUP_COMMIT) {
+					logCv.wait(lock, [&]() { return !queued.empty() || woken(); });
+				} else {
+					logCv.wait_for(lock, ASYNC_FLUSH_INTERVAL, woken);
+				}
+				stop = stopping;
+				batch.swap(queued);
+				upTo = nextLsn - 1;
+				fd = segmentFd;
+				recordsInSegment += batch.size();
+				// Requests up to here were made before the checkpoint reads the counts.
+				serving = checkpointsRequested;
+				snapshotDue = recordsInSegment >= snapshotEvery || serving > checkpointsDone;
+			}
+			if (!batch.empty()) {
+				writeAll(fd, batch.data(), batch.size() * sizeof(WalRecord));
+				sync(fd, segmentPath(segmentSeq));
+			}
+			publishDurable(upTo);
+			if (snapshotDue) {
+				checkpoint();
+				{
+					lock_guard<mutex> lock(logMtx);
+					checkpointsDone = max(checkpointsDone, serving);
+				}
+				checkpointCv.notify_all();
+			}
+			if (stop) return;
+		}
+	}
+
+	// Rotates the log, writes a snapshot of the counts, drops old segments.
+	// Runs on the flusher thread, or in the constructor before it starts.
+	void checkpoint() {
+		vector<WalRecord> batch;
+		vector<SnapshotEntry> entries;
+		uint64_t upTo, newSeq;
+		int oldFd;
+		{
+			lock_guard<mutex> lock(logMtx);
+			batch.swap(queued);
+			upTo = nextLsn - 1;
+			memory.forEachSku([&](int sku, int onHand) {
+				entries.push_back({sku, onHand});
+			});
+			oldFd = segmentFd;
+			newSeq = ++segmentSeq;
+			segmentFd = openSegment(newSeq);
+			recordsInSegment = 0;
+		}
+		if (oldFd >= 0) {
+			if (!batch.empty()) writeAll(oldFd, batch.data(), batch.size() * sizeof(WalRecord));
+			sync(oldFd, segmentPath(newSeq - 1));
+			::close(oldFd);
+		}
+		publishDurable(upTo);
+
+		string tmp = dir + "/snapshot.tmp";
+		int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) throw runtime_error("Cannot write inventory snapshot " + tmp);
+		SnapshotHeader header{{'I','N','V','S','N','A','P','1'}, newSeq, entries.size()};
+		writeAll(fd, &header, sizeof(header));
+		writeAll(fd, entries.data(), entries.size() * sizeof(SnapshotEntry));
+		sync(fd, tmp);
+		::close(fd);
+		filesystem::rename(tmp, dir + "/snapshot.bin");
+		int dirFd = ::open(dir.c_str(), O_RDONLY);
+		if (dirFd < 0) throw runtime_error("Cannot open " + dir + " to sync it");
+		int synced = fsync(dirFd);
+		::close(dirFd);
+		if (synced != 0) throw runtime_error("Cannot sync " + dir + ": " + strerror(errno));
+		for (auto& [seq, path] : listSegments()) {
+			if (seq < newSeq) filesystem::remove(path);
+		}
+	}
+
+	vector<pair<uint64_t,string>> listSegments() const {
+		vector<pair<uint64_t,string>> segments;
+		for (const filesystem::directory_entry& e : filesystem::directory_iterator(dir)) {
+			string name = e.path().filename().string();
+			if (name.rfind("wal.", 0) == 0 && name.size() > 8 && name.substr(name.size() - 4) == ".log") {
+				segments.push_back({stoull(name.substr(4, name.size() - 8)), e.path().string()});
+			}
+		}
+		sort(segments.begin(), segments.end());
+		return segments;
+	}
+
+	// Adds the net stock change of every intact record in `records` to
+	// `counts`, using one thread per chunk and then one per SKU range.
+	static void replay(const vector<WalRecord>& records, unordered_map<int,long long>& counts) {
+		size_t workers = max(1u, thread::hardware_concurrency());
+		size_t chunk = (records.size() + workers - 1) / workers;
+		auto runAll = [&](const function<void(size_t)>& fn) {
+			vector<thread> threads;
+			for (size_t w = 1; w < workers; w++) threads.emplace_back(fn, w);
+			fn(0);
+			for (thread& t : threads) t.join();
+		};
+
+		// A torn write can only be at the end: stop at the first bad record.
+		vector<size_t> firstBad(workers, records.size());
+		runAll([&](size_t w) {
+			for (size_t i = w * chunk; i < min(records.size(), (w + 1) * chunk); i++) {
+				if (records[i].check != checksum(records[i])) {
+					firstBad[w] = i;
+					break;
+				}
+			}
+		});
+		size_t valid = *min_element(firstBad.begin(), firstBad.end());
+
+		// partial[w][r]: deltas chunk w saw for SKUs in range r
+		vector<vector<unordered_map<int,long long>>> partial(workers, vector<unordered_map<int,long long>>(workers));
+		runAll([&](size_t w) {
+			for (size_t i = w * chunk; i < min(valid, (w + 1) * chunk); i++) {
+				const WalRecord& r = records[i];
+				long long delta = (r.op == ADD) ? r.qty : -(long long)r.qty;
+				partial[w][(uint32_t)r.sku % workers][r.sku] += delta;
+			}
+		});
+		vector<unordered_map<int,long long>> ranges(workers);
+		runAll([&](size_t r) {
+			for (size_t w = 0; w < workers; w++) {
+				for (auto& [sku, delta] : partial[w][r]) ranges[r][sku] += delta;
+			}
+		});
+		for (unordered_map<int,long long>& range : ranges) {
+			for (auto& [sku, delta] : range) counts[sku] += delta;
+		}
+	}
+
+	void recover() {
+		unordered_map<int,long long> counts;
+		uint64_t fromSeq = 0;
+		ifstream snap(dir + "/snapshot.bin", ios::binary);
+		if (snap) {
+			SnapshotHeader header;
+			if (!snap.read((char*)&header, sizeof(header)) || memcmp(header.magic, "INVSNAP1", 8) != 0) {
+				throw runtime_error("Corrupt inventory snapshot in " + dir);
+			}
+			vector<SnapshotEntry> entries(header.count);
+			snap.read((char*)entries.data(), entries.size() * sizeof(SnapshotEntry));
+			for (SnapshotEntry& e : entries) counts[e.sku] = e.available;
+			fromSeq = header.walSeq;
+		}
+
+		for (auto& [seq, path] : listSegments()) {
+			segmentSeq = max(segmentSeq, seq);
+			if (seq < fromSeq) continue;
+			ifstream in(path, ios::binary);
+			vector<WalRecord> records(filesystem::file_size(path) / sizeof(WalRecord));
+			in.read((char*)records.data(), records.size() * sizeof(WalRecord));
+			replay(records, counts);
+		}
+		segmentSeq = max(segmentSeq, fromSeq);
+
+		for (auto& [sku, qty] : counts) {
+			memory.addProduct(ProductFactory::createProduct(sku), (int)max(0LL, qty));
+		}
+		// Start from a fresh snapshot so the next recovery is just as short.
+		checkpoint();
+	}
+
+public:
+	DurableInventoryStore(const string& dir, Durability durability = Durability::GROUP_COMMIT,
+	                      uint64_t snapshotEvery = 1000000) {
+		this->dir = dir;
+		this->durability = durability;
+		this->snapshotEvery = snapshotEvery;
+		filesystem::create_directories(dir);
+		recover();
+		flusher = thread([this]() { flushLoop(); });
+	}
+
+	~DurableInventoryStore() {
+		{
+			lock_guard<mutex> lock(logMtx);
+			stopping = true;
+		}
+		logCv.notify_all();
+		flusher.join();
+		if (segmentFd >= 0) ::close(segmentFd);
+	}
+
+	void watchLowStock(int threshold, weak_ptr<StockListener> listener) override {
+		InventoryStore::watchLowStock(threshold, listener);
+		memory.watchLowStock(threshold, listener);
+	}
+
+	void observeStock(shared_ptr<StockObserver> observer) override {
+		memory.observeStock(observer);
+	}
+
+	void addProduct(shared_ptr<Product> prod, int qty) override {
+		logged(ADD, prod->getSku(), [&]() { memory.addProduct(prod, qty); return qty; });
+	}
+
+	void removeProduct(int sku, int qty) override {
+		logged(REMOVE, sku, [&]() { return memory.removeUpTo(sku, qty); });
+	}
+
+	int checkStock(int sku) override {
+		return memory.checkStock(sku);
+	}
+
+	vector<shared_ptr<Product>> listProduct() override {
+		return memory.listProduct();
+	}
+
+	bool reserve(int sku, int qty) override {
+		return memory.reserve(sku, qty);
+	}
+
+	void commitReserved(int sku, int qty) override {
+		logged(COMMIT, sku, [&]() { memory.commitReserved(sku, qty); return qty; });
+	}
+
+	void releaseReserved(int sku, int qty) override {
+		memory.releaseReserved(sku, qty);
+	}
+
+	// Forces a snapshot now, e.g. before a planned shutdown. Returns once
+	// the flusher has written one that includes every change made before
+	// the call.
+	void snapshot() {
+		unique_lock<mutex> lock(logMtx);
+		throwIfFailed();
+		uint64_t wanted = ++checkpointsRequested;
+		logCv.notify_one();
+		checkpointCv.wait(lock, [&]() { return checkpointsDone >= wanted || failed.load(); });
+		if (checkpointsDone < wanted) throwIfFailed();
+	}
 };
 
 
@@ -183,9 +1047,29 @@ public:
         return store->checkStock(sku);
     }
 
+    bool reserveStock(int sku, int qty) {
+        return store->reserve(sku, qty);
+    }
+
+    void commitStock(int sku, int qty) {
+        store->commitReserved(sku, qty);
+    }
+
+    void releaseStock(int sku, int qty) {
+        store->releaseReserved(sku, qty);
+    }
+
     vector<shared_ptr<Product>> getAvailableProducts() {
         return store->listProduct();
     }
+
+    void watchLowStock(int threshold, weak_ptr<StockListener> listener) {
+        store->watchLowStock(threshold, listener);
+    }
+
+    void observeStock(shared_ptr<StockObserver> observer) {
+        store->observeStock(observer);
+    }
 };
 
 
@@ -196,6 +1080,13 @@ public:
 class ReplenishStrategy {
 public:
 	virtual void replenish(shared_ptr<InventoryManager> manager, unordered_map<int,int> itemToReplanish) = 0;
+
+	// Stores report SKUs that drop below this (0: no low-stock events).
+	virtual int lowStockThreshold() { return 0; }
+
+	// How often the strategy runs on its own (0: only on low-stock events).
+	virtual chrono::seconds period() { return chrono::seconds(0); }
+
 	virtual ~ReplenishStrategy() {}
 };
 
@@ -221,139 +1112,1488 @@ public:
             }
         }
     }
-    
+
+    int lowStockThreshold() override {
+        return threshold;
+    }
 };
 
+// Delivers the store's standing order once a week, whatever the stock level.
 class WeeklyReplenishStrategy : public ReplenishStrategy {
 public:
     WeeklyReplenishStrategy() {}
     void replenish(shared_ptr<InventoryManager> manager, unordered_map<int,int> itemsToReplenish) override {
         cout << "[WeeklyReplenish] Weekly replenishment triggered for inventory.\n";
+        for (auto& [sku, qtyToAdd] : itemsToReplenish) {
+            manager->addStock(sku, qtyToAdd);
+        }
+    }
+
+    chrono::seconds period() override {
+        return chrono::hours(24 * 7);
     }
 };
 
 
 //////////////////////////////////////////////////////////////////
-//                DARK STORES 
+//                STOCK MATRIX 
 /////////////////////////////////////////////////////////////////
 
-class DarkStore {
-	string name;
-	double x,y;
-	shared_ptr<InventoryManager> inventoryManager;
+// Available stock for every (SKU, store) pair, laid out SKU-major: each SKU
+// row is one int32 lane per store, contiguous, in blocks of 8 lanes. Asking
+// "which stores have this cart" is then a handful of 8-wide compares per
+// cart line instead of a virtual checkStock per store per SKU.
+//   - stores push exact deltas through a StockObserver, so the matrix
+//     tracks them without ever re-reading them
+//   - finding a SKU's row is a lock-free probe; only a new SKU locks
+//   - lanes are updated with atomic adds and scanned with relaxed atomic
+//     loads, one lane at a time, so a scan is best-effort: it may be a few
+//     updates behind and need not be a snapshot of one instant. Staging
+//     still reserves on the real store, which keeps the matrix advisory.
+class StockMatrix {
+public:
+	typedef int32_t LaneBlock __attribute__((vector_size(32)));
+	static const int LANES_PER_BLOCK = 8;
+
+private:
+	struct Row {
+		int sku;
+		unique_ptr<LaneBlock[]> blocks;
+	};
+
+	struct RowTable {
+		size_t mask;
+		unique_ptr<atomic<Row*>[]> slots;
+		RowTable(size_t capacity) {
+			mask = capacity - 1;
+			slots = make_unique<atomic<Row*>[]>(capacity);
+			for (size_t i = 0; i < capacity; i++) slots[i].store(nullptr);
+		}
+	};
+
+	int laneCapacity;
+	int blocksPerRow;
+	atomic<int> laneCount{0};
+
+	atomic<RowTable*> table;
+	vector<unique_ptr<RowTable>> tables;   // old tables stay alive for readers
+	vector<unique_ptr<Row>> rows;
+	mutex writeMtx;
+
+	static size_t slotOf(int sku, size_t mask) {
+		return ((uint32_t)sku * 2654435761u) & mask;
+	}
+
+	static void place(RowTable* t, Row* row) {
+		size_t i = slotOf(row->sku, t->mask);
+		while (t->slots[i].load(memory_order_relaxed)) i = (i + 1) & t->mask;
+		t->slots[i].store(row, memory_order_release);
+	}
+
+	Row* find(int sku) const {
+		RowTable* t = table.load(memory_order_acquire);
+		for (size_t i = slotOf(sku, t->mask); ; i = (i + 1) & t->mask) {
+			Row* row = t->slots[i].load(memory_order_acquire);
+			if (!row || row->sku == sku) return row;
+		}
+	}
+
+	Row* findOrCreate(int sku) {
+		Row* row = find(sku);
+		if (row) return row;
+
+		lock_guard<mutex> lock(writeMtx);
+		row = find(sku);
+		if (row) return row;
+
+		rows.push_back(make_unique<Row>());
+		row = rows.back().get();
+		row->sku = sku;
+		row->blocks.reset(new LaneBlock[blocksPerRow]());
+
+		RowTable* current = table.load(memory_order_relaxed);
+		if (rows.size() * 2 > current->mask + 1) {
+			tables.push_back(make_unique<RowTable>((current->mask + 1) * 2));
+			RowTable* bigger = tables.back().get();
+			for (unique_ptr<Row>& existing : rows) place(bigger, existing.get());
+			table.store(bigger, memory_order_release);
+		} else {
+			place(current, row);
+		}
+		return row;
+	}
+
+	// Writers add to single lanes atomically, so scans must not read a
+	// block with one plain vector load.
+	static void loadBlock(const LaneBlock* blocks, int b, LaneBlock& block) {
+		const int32_t* lanes = (const int32_t*)(blocks + b);
+		for (int l = 0; l < LANES_PER_BLOCK; l++) block[l] = __atomic_load_n(&lanes[l], __ATOMIC_RELAXED);
+	}
+
+	int usedBlocks() const {
+		return (laneCount.load() + LANES_PER_BLOCK - 1) / LANES_PER_BLOCK;
+	}
+
+public:
+	StockMatrix(int laneCapacity) {
+		this->blocksPerRow = (laneCapacity + LANES_PER_BLOCK - 1) / LANES_PER_BLOCK;
+		this->laneCapacity = blocksPerRow * LANES_PER_BLOCK;
+		tables.push_back(make_unique<RowTable>(64));
+		table.store(tables.back().get());
+	}
+
+	// A lane for one more store, or -1 once the matrix is full.
+	int addLane() {
+		int lane = laneCount.load();
+		while (lane < laneCapacity) {
+			if (laneCount.compare_exchange_weak(lane, lane + 1)) return lane;
+		}
+		return -1;
+	}
+
+	void add(int lane, int sku, int delta) {
+		int32_t* lanes = (int32_t*)findOrCreate(sku)->blocks.get();
+		__atomic_fetch_add(&lanes[lane], delta, __ATOMIC_RELAXED);
+	}
+
+	int stockAt(int lane, int sku) const {
+		Row* row = find(sku);
+		return row ? __atomic_load_n(&((int32_t*)row->blocks.get())[lane], __ATOMIC_RELAXED) : 0;
+	}
+
+	// Lanes whose store holds every line of the cart on its own.
+	vector<int> lanesThatCanFill(const vector<pair<int,int>>& cart) const {
+		int blocks = usedBlocks();
+		vector<LaneBlock> ok(blocks);
+		for (LaneBlock& b : ok) b = (LaneBlock){} - 1;   // all lanes pass so far
+		for (auto& [sku, qty] : cart) {
+			Row* row = find(sku);
+			if (!row) return {};
+			const LaneBlock* stock = row->blocks.get();
+			LaneBlock has;
+			for (int b = 0; b < blocks; b++) {
+				loadBlock(stock, b, has);
+				ok[b] &= (has >= qty);
+			}
+		}
+		vector<int> lanes;
+		int used = laneCount.load();
+		for (int b = 0; b < blocks; b++) {
+			for (int l = 0; l < LANES_PER_BLOCK; l++) {
+				int lane = b * LANES_PER_BLOCK + l;
+				if (ok[b][l] && lane < used) lanes.push_back(lane);
+			}
+		}
+		return lanes;
+	}
+
+	// Up to k lanes that cover the most units of the cart, best first, as
+	// (lane, units covered). A store counts at most the quantity asked for.
+	vector<pair<int,int>> bestLanes(const vector<pair<int,int>>& cart, int k) const {
+		int blocks = usedBlocks();
+		vector<LaneBlock> covered(blocks, LaneBlock{});
+		for (auto& [sku, qty] : cart) {
+			Row* row = find(sku);
+			if (!row) continue;
+			const LaneBlock* stock = row->blocks.get();
+			LaneBlock want = (LaneBlock){} + qty;
+			LaneBlock has;
+			for (int b = 0; b < blocks; b++) {
+				loadBlock(stock, b, has);
+				has = has > 0 ? has : (LaneBlock){};
+				covered[b] += has < want ? has : want;
+			}
+		}
+		vector<pair<int,int>> best;
+		int used = laneCount.load();
+		for (int lane = 0; lane < used; lane++) {
+			int units = covered[lane / LANES_PER_BLOCK][lane % LANES_PER_BLOCK];
+			if (units > 0) best.push_back({lane, units});
+		}
+		auto byUnits = [](const pair<int,int>& a, const pair<int,int>& b) {
+			return a.second != b.second ? a.second > b.second : a.first < b.first;
+		};
+		if ((int)best.size() > k) {
+			partial_sort(best.begin(), best.begin() + k, best.end(), byUnits);
+			best.resize(k);
+		} else {
+			sort(best.begin(), best.end(), byUnits);
+		}
+		return best;
+	}
+};
+
+// Feeds one store's stock changes into its lane of the matrix.
+class MatrixLaneObserver : public StockObserver {
+private:
+	StockMatrix* matrix;
+	int lane;
+public:
+	MatrixLaneObserver(StockMatrix* matrix, int lane) {
+		this->matrix = matrix;
+		this->lane = lane;
+	}
+
+	void onStockDelta(int sku, int delta, int) override {
+		matrix->add(lane, sku, delta);
+	}
+};
+
+
+//////////////////////////////////////////////////////////////////
+//                STOREFRONT LISTING
+/////////////////////////////////////////////////////////////////
+
+// What one store had in stock at some moment. Never changes once
+// published, so any number of readers can page through it at once.
+// Product pointers stay valid while the snapshot is held.
+class ListingSnapshot {
+private:
+	static bool cheaper(const shared_ptr<Product>& a, const shared_ptr<Product>& b) {
+		if (a->getPrice() != b->getPrice()) return a->getPrice() < b->getPrice();
+		return a->getSku() < b->getSku();
+	}
+
+	static bool categoryThenCheaper(const shared_ptr<Product>& a, const shared_ptr<Product>& b) {
+		if (a->getCategory() != b->getCategory()) return a->getCategory() < b->getCategory();
+		return cheaper(a, b);
+	}
+
+	template <typename It>
+	static vector<const Product*> slice(It from, It to, size_t offset, size_t limit) {
+		vector<const Product*> page;
+		if (offset >= (size_t)(to - from)) return page;
+		for (It it = from + offset; it != to && page.size() < limit; ++it) page.push_back(it->get());
+		return page;
+	}
+
+public:
+	uint64_t version = 0;                     // bumped on every change
+	vector<shared_ptr<Product>> byPrice;      // cheapest first, ties by SKU
+	vector<shared_ptr<Product>> byCategory;   // by category, then as byPrice
+
+	static shared_ptr<ListingSnapshot> of(vector<shared_ptr<Product>> products) {
+		shared_ptr<ListingSnapshot> snapshot = make_shared<ListingSnapshot>();
+		sort(products.begin(), products.end(), cheaper);
+		snapshot->byPrice = products;
+		sort(products.begin(), products.end(), categoryThenCheaper);
+		snapshot->byCategory = move(products);
+		return snapshot;
+	}
+
+	size_t size() const {
+		return byPrice.size();
+	}
+
+	// The same listing with `product` added, or taken out (it must be listed).
+	shared_ptr<ListingSnapshot> with(const shared_ptr<Product>& product, bool inStock) const {
+		shared_ptr<ListingSnapshot> next = make_shared<ListingSnapshot>(*this);
+		next->version = version + 1;
+		auto byPriceAt = lower_bound(next->byPrice.begin(), next->byPrice.end(), product, cheaper);
+		auto byCategoryAt = lower_bound(next->byCategory.begin(), next->byCategory.end(), product, categoryThenCheaper);
+		if (inStock) {
+			next->byPrice.insert(byPriceAt, product);
+			next->byCategory.insert(byCategoryAt, product);
+		} else {
+			next->byPrice.erase(byPriceAt);
+			next->byCategory.erase(byCategoryAt);
+		}
+		return next;
+	}
+
+	// Everything in stock, cheapest first.
+	vector<const Product*> page(size_t offset, size_t limit) const {
+		return slice(byPrice.begin(), byPrice.end(), offset, limit);
+	}
+
+	// One category, cheapest first.
+	vector<const Product*> categoryPage(const string& category, size_t offset, size_t limit) const {
+		auto first = partition_point(byCategory.begin(), byCategory.end(),
+		                             [&](const shared_ptr<Product>& p) { return p->getCategory() < category; });
+		auto last = partition_point(first, byCategory.end(),
+		                            [&](const shared_ptr<Product>& p) { return p->getCategory() == category; });
+		return slice(first, last, offset, limit);
+	}
+};
+
+// Keeps a store's in-stock listing current as stock moves, so browsing
+// never walks the inventory. Only a SKU crossing zero changes the listing:
+// the change is applied to a copy that is then published as the new
+// snapshot. Readers just load the current snapshot.
+class StorefrontListing : public StockObserver {
+private:
+	InventoryStore* store;                    // the store this observes; it owns us
+	shared_ptr<const ListingSnapshot> current;
+	unordered_map<int, shared_ptr<Product>> listed;   // sku -> the product as listed
+	mutex writeMtx;
+
+public:
+	StorefrontListing(InventoryStore* store) {
+		this->store = store;
+		vector<shared_ptr<Product>> products = store->listProduct();
+		for (shared_ptr<Product>& product : products) listed[product->getSku()] = product;
+		current = ListingSnapshot::of(move(products));
+	}
+
+	shared_ptr<const ListingSnapshot> snapshot() const {
+		return atomic_load(&current);
+	}
+
+	void onStockDelta(int sku, int delta, int available) override {
+		if ((available > 0) == (available - delta > 0)) return;
+		// Concurrent moves can cross zero in either order; the store's
+		// count at the time we hold the lock settles it.
+		lock_guard<mutex> lock(writeMtx);
+		bool inStock = store->checkStock(sku) > 0;
+		auto it = listed.find(sku);
+		if ((it != listed.end()) == inStock) return;
+		shared_ptr<Product> product;
+		if (inStock) {
+			product = listed[sku] = ProductFactory::createProduct(sku);
+		} else {
+			product = it->second;
+			listed.erase(it);
+		}
+		atomic_store(&current, shared_ptr<const ListingSnapshot>(current->with(product, inStock)));
+	}
+};
+
+
+//////////////////////////////////////////////////////////////////
+//                DARK STORES 
+/////////////////////////////////////////////////////////////////
+
+class DarkStore : public StockListener, public enable_shared_from_this<DarkStore> {
+	string name;
+	double x,y;
+	shared_ptr<InventoryManager> inventoryManager;
+	shared_ptr<StorefrontListing> listing;
 	shared_ptr<ReplenishStrategy> replenishStrategy;
+	atomic<int> strategyVersion{0};        // lets a replaced strategy's weekly timer retire itself
+	int matrixLane = -1;                   // this store's lane in the StockMatrix, if any
+
+	// How much one restock brings in, per SKU; also the weekly standing order.
+	unordered_map<int,int> restockQuantities;
+	static const int DEFAULT_RESTOCK_QTY = 10;
 
 public:
 
-	DarkStore(string name, int x, int y){
+	DarkStore(string name, double x, double y, shared_ptr<InventoryStore> store = nullptr){
 		this->name = name;
 		this->x = x;
 		this->y = y;
 		
-		this->inventoryManager = make_shared<InventoryManager>(make_shared<DbInventoryStore>());
+		if (!store) store = make_shared<ConcurrentInventoryStore>();
+		this->inventoryManager = make_shared<InventoryManager>(store);
+		this->listing = make_shared<StorefrontListing>(store.get());
+		this->inventoryManager->observeStock(listing);
+	}
+
+	double distanceTo(double ux, double uy){
+		return sqrt((x - ux)*(x - ux) + (y - uy)*(y - uy));
+	}
+
+	void runReplanishment(unordered_map<int,int> itemsToReplenish){
+		if(replenishStrategy){
+			replenishStrategy->replenish(inventoryManager, itemsToReplenish);
+		}
+	}
+
+	vector<shared_ptr<Product>> getAllProducts() {
+		return listing->snapshot()->byPrice;
+	}
+
+	// What's in stock right now, for browsing; no locks, no copying.
+	shared_ptr<const ListingSnapshot> getListing() {
+		return listing->snapshot();
+	}
+
+	int checkStock(int sku) {
+        return inventoryManager->checkStock(sku);
+    }
+
+    void removeStock(int sku, int qty) {
+        inventoryManager->removeStock(sku, qty); 
+    }
+
+    void addStock(int sku, int qty) {
+        inventoryManager->addStock(sku, qty);
+    }
+
+    bool reserveStock(int sku, int qty) {
+        return inventoryManager->reserveStock(sku, qty);
+    }
+
+    void commitStock(int sku, int qty) {
+        inventoryManager->commitStock(sku, qty);
+    }
+
+    void releaseStock(int sku, int qty) {
+        inventoryManager->releaseStock(sku, qty);
+    }
+
+    // Low-stock events are batched by the ReplenishmentScheduler; see below.
+    void onLowStock(int sku, int available) override;
+
+    void setRestockQuantity(int sku, int qty) {
+        restockQuantities[sku] = qty;
+    }
+
+    int getRestockQuantity(int sku) {
+        auto it = restockQuantities.find(sku);
+        return it == restockQuantities.end() ? DEFAULT_RESTOCK_QTY : it->second;
+    }
+
+    unordered_map<int,int> getStandingOrder() {
+        return restockQuantities;
+    }
+
+    int getStrategyVersion() {
+        return strategyVersion.load();
+    }
+
+    // Mirrors this store's stock into `lane` of the matrix from now on.
+    // Call at setup, before the store takes orders.
+    void mirrorStockTo(StockMatrix* matrix, int lane) {
+        matrixLane = lane;
+        inventoryManager->observeStock(make_shared<MatrixLaneObserver>(matrix, lane));
+        for (shared_ptr<Product>& product : getAllProducts()) {
+            matrix->add(lane, product->getSku(), checkStock(product->getSku()));
+        }
+    }
+
+    int getMatrixLane() {
+        return matrixLane;
+    }
+
+    // Getters & Setters
+    // Call once the store is owned by a shared_ptr, before it takes orders.
+    void setReplenishStrategy(shared_ptr<ReplenishStrategy> strategy);
+
+    string getName() {
+        return this->name;
+    }
+
+    double getXCoordinate() {
+        return this->x;
+    }
+
+    double getYCoordinate() {
+        return this->y;
+    }
+
+    shared_ptr<InventoryManager> getInventoryManager() {
+        return this->inventoryManager;
+    }
+};
+
+
+//////////////////////////////////////////////////////////////////
+//              REPLENISHMENT SCHEDULER 
+/////////////////////////////////////////////////////////////////
+
+// Timers bucketed by expiry tick in 4 levels of 64 slots. Level 0 holds
+// the next 64 ticks one slot per tick; each level above covers 64x more
+// time per slot and is cascaded down a level when its slot comes round.
+// Scheduling and expiring are O(1) however many timers are pending.
+// Not thread safe: the scheduler guards it.
+class HierarchicalTimerWheel {
+private:
+	static const int LEVELS = 4;
+	static const int SLOT_BITS = 6;
+	static const int SLOTS = 1 << SLOT_BITS;
+
+	struct Timer {
+		uint64_t due;
+		function<void()> task;
+	};
+
+	vector<Timer> slots[LEVELS][SLOTS];
+	vector<Timer> overflow;   // further out than the top level reaches
+	uint64_t now = 0;
+
+	void place(Timer timer) {
+		uint64_t delta = timer.due > now ? timer.due - now : 0;
+		for (int level = 0; level < LEVELS; level++) {
+			if (delta < (1ull << (SLOT_BITS * (level + 1)))) {
+				size_t slot = (max(timer.due, now) >> (SLOT_BITS * level)) & (SLOTS - 1);
+				slots[level][slot].push_back(move(timer));
+				return;
+			}
+		}
+		overflow.push_back(move(timer));
+	}
+
+	void cascade(vector<Timer>& bucket) {
+		vector<Timer> timers;
+		timers.swap(bucket);
+		for (Timer& timer : timers) place(move(timer));
 	}
 
-	double distanceTo(int ux, int uy){
-		return sqrt((x - ux)*(x - ux) + (y - uy)*(y - uy));
-	}
+public:
+	uint64_t currentTick() const { return now; }
+
+	// Runs `task` `delay` ticks from now (at least one).
+	void schedule(uint64_t delay, function<void()> task) {
+		place({now + max<uint64_t>(delay, 1), move(task)});
+	}
+
+	// Moves one tick forward and hands back the tasks that came due.
+	void tick(vector<function<void()>>& due) {
+		now++;
+		for (int level = 1; level < LEVELS; level++) {
+			if (now & ((1ull << (SLOT_BITS * level)) - 1)) break;
+			cascade(slots[level][(now >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+		}
+		if ((now & ((1ull << (SLOT_BITS * LEVELS)) - 1)) == 0) cascade(overflow);
+
+		for (Timer& timer : slots[0][now & (SLOTS - 1)]) due.push_back(move(timer.task));
+		slots[0][now & (SLOTS - 1)].clear();
+	}
+};
+
+// Singleton
+// Turns low-stock events into restocks, and runs periodic strategies.
+//   - a store's first low SKU opens a short batching window; every SKU
+//     that goes low before it closes rides in the same restock
+//   - weekly (or any periodic) strategies re-arm themselves on the wheel
+// Time is counted in one-second ticks. advance() drives it by hand (demo,
+// simulation); startClock() ticks it from a background thread until
+// stopClock().
+class ReplenishmentScheduler {
+private:
+	HierarchicalTimerWheel wheel;
+	mutex wheelMtx;
+
+	unordered_map<DarkStore*, pair<shared_ptr<DarkStore>, set<int>>> pendingLow;
+	mutex pendingMtx;
+
+	// How long a store collects low SKUs before restocking them together.
+	static const uint64_t BATCH_WINDOW_TICKS = 60;
+
+	mutex clockControlMtx;   // one start/stop at a time
+	mutex clockMtx;
+	condition_variable clockCv;
+	bool clockStopping = false;
+	thread clock;
+
+	static ReplenishmentScheduler* instance;
+	static mutex mtx;
+
+	ReplenishmentScheduler() {}
+
+	void scheduleIn(uint64_t ticks, function<void()> task) {
+		lock_guard<mutex> lock(wheelMtx);
+		wheel.schedule(ticks, move(task));
+	}
+
+	void flushLowStock(DarkStore* key) {
+		shared_ptr<DarkStore> store;
+		set<int> skus;
+		{
+			lock_guard<mutex> lock(pendingMtx);
+			auto it = pendingLow.find(key);
+			if (it == pendingLow.end()) return;
+			store = it->second.first;
+			skus.swap(it->second.second);
+			pendingLow.erase(it);
+		}
+		unordered_map<int,int> batch;
+		for (int sku : skus) batch[sku] = store->getRestockQuantity(sku);
+		store->runReplanishment(batch);
+	}
+
+	void runPeriodic(weak_ptr<DarkStore> weakStore, int version, uint64_t periodTicks) {
+		shared_ptr<DarkStore> store = weakStore.lock();
+		if (!store || store->getStrategyVersion() != version) return;
+		store->runReplanishment(store->getStandingOrder());
+		scheduleIn(periodTicks, [this, weakStore, version, periodTicks]() {
+			runPeriodic(weakStore, version, periodTicks);
+		});
+	}
+
+public:
+	static ReplenishmentScheduler* getInstance() {
+		if(instance == nullptr) {
+			lock_guard<mutex> lock(mtx);
+			if(instance == nullptr){
+				instance = new ReplenishmentScheduler();
+			}
+		}
+		return instance;
+	}
+
+	// Called on the order path; only the first low SKU per window schedules.
+	void lowStock(shared_ptr<DarkStore> store, int sku) {
+		bool openWindow;
+		{
+			lock_guard<mutex> lock(pendingMtx);
+			auto& entry = pendingLow[store.get()];
+			openWindow = entry.second.empty();
+			entry.first = store;
+			entry.second.insert(sku);
+		}
+		if (openWindow) {
+			DarkStore* key = store.get();
+			scheduleIn(BATCH_WINDOW_TICKS, [this, key]() { flushLowStock(key); });
+		}
+	}
+
+	void scheduleEvery(shared_ptr<DarkStore> store, chrono::seconds period) {
+		uint64_t periodTicks = max<long long>(1, period.count());
+		weak_ptr<DarkStore> weakStore = store;
+		int version = store->getStrategyVersion();
+		scheduleIn(periodTicks, [this, weakStore, version, periodTicks]() {
+			runPeriodic(weakStore, version, periodTicks);
+		});
+	}
+
+	// Moves schedule time forward, running whatever comes due, in order.
+	void advance(chrono::seconds elapsed) {
+		vector<function<void()>> due;
+		for (long long t = 0; t < elapsed.count(); t++) {
+			{
+				lock_guard<mutex> lock(wheelMtx);
+				wheel.tick(due);
+			}
+			for (function<void()>& task : due) task();
+			due.clear();
+		}
+	}
+
+	void startClock(chrono::milliseconds perTick = chrono::seconds(1)) {
+		lock_guard<mutex> control(clockControlMtx);
+		if (clock.joinable()) throw runtime_error("Replenishment clock already running");
+		{
+			lock_guard<mutex> lock(clockMtx);
+			clockStopping = false;
+		}
+		clock = thread([this, perTick]() {
+			unique_lock<mutex> lock(clockMtx);
+			while (!clockCv.wait_for(lock, perTick, [this]() { return clockStopping; })) {
+				lock.unlock();
+				advance(chrono::seconds(1));
+				lock.lock();
+			}
+		});
+	}
+
+	void stopClock() {
+		lock_guard<mutex> control(clockControlMtx);
+		{
+			lock_guard<mutex> lock(clockMtx);
+			clockStopping = true;
+		}
+		clockCv.notify_all();
+		if (clock.joinable()) clock.join();
+	}
+};
+
+ReplenishmentScheduler* ReplenishmentScheduler::instance = nullptr;
+mutex ReplenishmentScheduler::mtx;
+
+void DarkStore::onLowStock(int sku, int) {
+	ReplenishmentScheduler::getInstance()->lowStock(shared_from_this(), sku);
+}
+
+void DarkStore::setReplenishStrategy(shared_ptr<ReplenishStrategy> strategy) {
+	// Created here, at setup, rather than first on the order path.
+	ReplenishmentScheduler* scheduler = ReplenishmentScheduler::getInstance();
+	this->replenishStrategy = strategy;
+	strategyVersion++;
+	inventoryManager->watchLowStock(strategy ? strategy->lowStockThreshold() : 0, weak_from_this());
+	if (strategy && strategy->period().count() > 0) {
+		scheduler->scheduleEvery(shared_from_this(), strategy->period());
+	}
+}
+
+/////////////////////////////////////////////
+// Spatial Index (Uniform Grid)
+/////////////////////////////////////////////
+
+// Buckets points into square cells so a query only looks at the cells
+// around it instead of every point. Results come back ordered by distance.
+template <typename T>
+class UniformGridIndex {
+private:
+    struct Entry {
+        double x, y;
+        T item;
+    };
+
+    double cellSize;
+    unordered_map<long long, vector<Entry>> cells;
+    int minCellX, maxCellX, minCellY, maxCellY;   // bounds of occupied cells
+    int count;
+
+    int cellOf(double coordinate) const {
+        return (int)floor(coordinate / cellSize);
+    }
+
+    static long long keyOf(int cx, int cy) {
+        return ((long long)cx << 32) ^ (unsigned int)cy;
+    }
+
+    void collectCell(int cx, int cy, double x, double y, double maxDistance,
+                     vector<pair<double,T>>& out) const {
+        auto it = cells.find(keyOf(cx, cy));
+        if (it == cells.end()) return;
+        for (const Entry& e : it->second) {
+            double d = sqrt((e.x - x) * (e.x - x) + (e.y - y) * (e.y - y));
+            if (d <= maxDistance) {
+                out.push_back(make_pair(d, e.item));
+            }
+        }
+    }
+
+    static void sortByDistance(vector<pair<double,T>>& found) {
+        sort(found.begin(), found.end(),
+             [](const pair<double,T>& a, const pair<double,T>& b){ return a.first < b.first; });
+    }
+
+public:
+    UniformGridIndex(double cellSize) {
+        this->cellSize = cellSize;
+        minCellX = minCellY = INT_MAX;
+        maxCellX = maxCellY = INT_MIN;
+        count = 0;
+    }
+
+    int size() const {
+        return count;
+    }
+
+    void insert(double x, double y, T item) {
+        int cx = cellOf(x), cy = cellOf(y);
+        cells[keyOf(cx, cy)].push_back({x, y, item});
+        minCellX = min(minCellX, cx); maxCellX = max(maxCellX, cx);
+        minCellY = min(minCellY, cy); maxCellY = max(maxCellY, cy);
+        count++;
+    }
+
+    bool remove(double x, double y, const T& item) {
+        auto it = cells.find(keyOf(cellOf(x), cellOf(y)));
+        if (it == cells.end()) return false;
+        vector<Entry>& bucket = it->second;
+        for (size_t i = 0; i < bucket.size(); i++) {
+            if (bucket[i].item == item) {
+                bucket[i] = bucket.back();
+                bucket.pop_back();
+                if (bucket.empty()) cells.erase(it);
+                count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Everything within maxDistance, nearest first.
+    vector<pair<double,T>> withinRadius(double x, double y, double maxDistance) const {
+        vector<pair<double,T>> found;
+        if (count == 0) return found;
+        int fromX = max(minCellX, cellOf(x - maxDistance)), toX = min(maxCellX, cellOf(x + maxDistance));
+        int fromY = max(minCellY, cellOf(y - maxDistance)), toY = min(maxCellY, cellOf(y + maxDistance));
+        for (int cx = fromX; cx <= toX; cx++) {
+            for (int cy = fromY; cy <= toY; cy++) {
+                collectCell(cx, cy, x, y, maxDistance, found);
+            }
+        }
+        sortByDistance(found);
+        return found;
+    }
+
+    // Up to k closest within maxDistance, nearest first. Searches outward
+    // ring by ring and stops once no unvisited cell can hold anything closer.
+    vector<pair<double,T>> nearest(double x, double y, int k, double maxDistance = 1e18) const {
+        vector<pair<double,T>> found;
+        if (count == 0 || k <= 0) return found;
+        int cx = cellOf(x), cy = cellOf(y);
+        int maxRing = max(max(abs(cx - minCellX), abs(cx - maxCellX)),
+                          max(abs(cy - minCellY), abs(cy - maxCellY)));
+        for (int ring = 0; ring <= maxRing; ring++) {
+            for (int dx = -ring; dx <= ring; dx++) {
+                for (int dy = -ring; dy <= ring; dy++) {
+                    if (max(abs(dx), abs(dy)) != ring) continue;   // only the ring's border
+                    collectCell(cx + dx, cy + dy, x, y, maxDistance, found);
+                }
+            }
+            // Anything outside the visited square is at least ring * cellSize away.
+            double settled = ring * cellSize;
+            if ((int)found.size() >= k) {
+                nth_element(found.begin(), found.begin() + (k - 1), found.end(),
+                            [](const pair<double,T>& a, const pair<double,T>& b){ return a.first < b.first; });
+                if (found[k - 1].first <= settled) break;
+            }
+            if (settled > maxDistance) break;
+        }
+        sortByDistance(found);
+        if ((int)found.size() > k) found.resize(k);
+        return found;
+    }
+};
+
+/////////////////////////////////////////////
+// Region Shards
+/////////////////////////////////////////////
+
+// The stores in one square region of the map, plus the queue of orders
+// waiting to be placed there. A shard's orders run one at a time in
+// arrival order, so its stores only ever see one order placer.
+class RegionShard {
+private:
+    vector<shared_ptr<DarkStore>> stores;
+    UniformGridIndex<shared_ptr<DarkStore>> storeIndex{2.5};
+
+    mutex queueMtx;
+    deque<function<void()>> queue;
+    bool draining = false;   // someone is (or is about to be) running the queue
+
+public:
+    const int regionX, regionY;
+
+    RegionShard(int regionX, int regionY) : regionX(regionX), regionY(regionY) {}
+
+    // Setup only, before orders start.
+    void addStore(shared_ptr<DarkStore> store) {
+        stores.push_back(store);
+        storeIndex.insert(store->getXCoordinate(), store->getYCoordinate(), store);
+    }
+
+    const vector<shared_ptr<DarkStore>>& getStores() const {
+        return stores;
+    }
+
+    // This shard's stores within maxDistance, nearest first.
+    vector<shared_ptr<DarkStore>> storesNear(double x, double y, double maxDistance) const {
+        vector<shared_ptr<DarkStore>> result;
+        for (auto& [d, store] : storeIndex.withinRadius(x, y, maxDistance)) result.push_back(store);
+        return result;
+    }
+
+    // Distance to this shard's closest store, if one is within maxDistance.
+    optional<double> closestStore(double x, double y, double maxDistance) const {
+        auto found = storeIndex.nearest(x, y, 1, maxDistance);
+        if (found.empty()) return nullopt;
+        return found[0].first;
+    }
+
+    // True if the queue was idle: the caller must then get it drained.
+    bool enqueue(function<void()> order) {
+        lock_guard<mutex> lock(queueMtx);
+        queue.push_back(move(order));
+        if (draining) return false;
+        draining = true;
+        return true;
+    }
+
+    // Runs the oldest queued order. Once the queue is empty, returns false
+    // and the shard goes idle until the next enqueue.
+    bool runNext() {
+        function<void()> order;
+        {
+            lock_guard<mutex> lock(queueMtx);
+            if (queue.empty()) {
+                draining = false;
+                return false;
+            }
+            order = move(queue.front());
+            queue.pop_front();
+        }
+        order();
+        return true;
+    }
+};
+
+/////////////////////////////////////////////
+// DarkStoreManager (Singleton)
+/////////////////////////////////////////////
+
+class DarkStoreManager {
+private:
+	vector<shared_ptr<DarkStore>> darkStores;
+    // Cells about half the usual 5 KM search radius: a radius query touches ~5x5 cells.
+    UniformGridIndex<shared_ptr<DarkStore>> storeIndex{2.5};
+    // Stores past this many are still served, just without a matrix lane.
+    static const int STOCK_MATRIX_LANES = 1024;
+    StockMatrix stockMatrix{STOCK_MATRIX_LANES};
+    vector<shared_ptr<DarkStore>> storeByLane;
+    // Stores are also split into square regions, each owned by one shard.
+    // At least the delivery radius wide, so a user's stores in range are
+    // all in their own region or one next to it.
+    static constexpr double REGION_KM = 10.0;
+    map<pair<int,int>, shared_ptr<RegionShard>> regions;
+    static DarkStoreManager* instance;
+    static mutex mtx;
+
+    DarkStoreManager() {
+        //darkStores.resize(0);
+    }
+
+    static pair<int,int> regionOf(double x, double y) {
+        return {(int)floor(x / REGION_KM), (int)floor(y / REGION_KM)};
+    }
+
+    static vector<shared_ptr<DarkStore>> storesOnly(const vector<pair<double,shared_ptr<DarkStore>>>& found) {
+        vector<shared_ptr<DarkStore>> result;
+        result.reserve(found.size());
+        for (auto &p : found) {
+            result.push_back(p.second);
+        }
+        return result;
+    }
+
+public:
+	static DarkStoreManager* getInstance() {
+		if(instance == nullptr){
+			lock_guard<mutex> lock(mtx);
+			if(instance == nullptr) {
+				instance = new DarkStoreManager();
+			}
+		}
+
+		return instance;
+	}
+
+
+	void registerDarkStore(shared_ptr<DarkStore> ds){
+		this->darkStores.push_back(ds);
+		storeIndex.insert(ds->getXCoordinate(), ds->getYCoordinate(), ds);
+		int lane = stockMatrix.addLane();
+		if (lane >= 0) {
+			ds->mirrorStockTo(&stockMatrix, lane);
+			storeByLane.push_back(ds);
+		}
+		pair<int,int> region = regionOf(ds->getXCoordinate(), ds->getYCoordinate());
+		shared_ptr<RegionShard>& shard = regions[region];
+		if (!shard) shard = make_shared<RegionShard>(region.first, region.second);
+		shard->addStore(ds);
+	}
+
+	static double getRegionSize() {
+		return REGION_KM;
+	}
+
+	// The shard whose region holds (x, y), or nullptr if it has no stores.
+	shared_ptr<RegionShard> getRegionShard(double x, double y) {
+		auto it = regions.find(regionOf(x, y));
+		return it == regions.end() ? nullptr : it->second;
+	}
+
+	// Shards of the up to 8 regions around (x, y)'s own.
+	vector<shared_ptr<RegionShard>> getNeighbourShards(double x, double y) {
+		vector<shared_ptr<RegionShard>> result;
+		pair<int,int> home = regionOf(x, y);
+		for (int dx = -1; dx <= 1; dx++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				if (dx == 0 && dy == 0) continue;
+				auto it = regions.find({home.first + dx, home.second + dy});
+				if (it != regions.end()) result.push_back(it->second);
+			}
+		}
+		return result;
+	}
+
+	vector<shared_ptr<RegionShard>> getRegionShards() {
+		vector<shared_ptr<RegionShard>> result;
+		for (auto& [region, shard] : regions) result.push_back(shard);
+		return result;
+	}
+
+	StockMatrix* getStockMatrix() {
+		return &stockMatrix;
+	}
+
+	// Stores that could ship the whole cart alone, in registration order.
+	vector<shared_ptr<DarkStore>> getStoresThatCanFill(const vector<pair<int,int>>& cart) {
+		vector<shared_ptr<DarkStore>> result;
+		for (int lane : stockMatrix.lanesThatCanFill(cart)) result.push_back(storeByLane[lane]);
+		return result;
+	}
+
+	// Up to k stores covering the most units of the cart, best first.
+	vector<shared_ptr<DarkStore>> getBestStoresFor(const vector<pair<int,int>>& cart, int k) {
+		vector<shared_ptr<DarkStore>> result;
+		for (auto& [lane, units] : stockMatrix.bestLanes(cart, k)) result.push_back(storeByLane[lane]);
+		return result;
+	}
+
+	// Stores within maxDistance, nearest first.
+	vector<shared_ptr<DarkStore>> getNearbyDarkStores(double ux, double uy, double maxDistance) {
+        return storesOnly(storeIndex.withinRadius(ux, uy, maxDistance));
+    }
+
+	// The k closest stores within maxDistance, nearest first.
+	vector<shared_ptr<DarkStore>> getNearestDarkStores(double ux, double uy, int k, double maxDistance) {
+        return storesOnly(storeIndex.nearest(ux, uy, k, maxDistance));
+    }
+};
+
+DarkStoreManager* DarkStoreManager::instance = nullptr;
+mutex DarkStoreManager::mtx;
+
+/////////////////////////////////////////////
+// Stock Reservations (two-phase, with TTL)
+/////////////////////////////////////////////
+
+struct ReservationLine {
+    shared_ptr<DarkStore> store;
+    int sku;
+    int qty;
+};
+
+enum class ReservationState { HELD, COMMITTED, RELEASED };
+
+// Stock held across one or more dark stores for a single checkout. Commit,
+// release and expiry race on one atomic state: whichever flips it away from
+// HELD first decides what happens to the stock.
+class StockReservation {
+private:
+    int reservationId;
+    vector<ReservationLine> lines;
+    chrono::steady_clock::time_point expiresAt;
+    atomic<ReservationState> state;
+    function<void()> onFinished;   // takes it off the expiry schedule
+
+    bool finish(ReservationState outcome) {
+        ReservationState expected = ReservationState::HELD;
+        if (!state.compare_exchange_strong(expected, outcome)) return false;
+        for (ReservationLine& line : lines) {
+            if (outcome == ReservationState::COMMITTED) {
+                line.store->commitStock(line.sku, line.qty);
+            } else {
+                line.store->releaseStock(line.sku, line.qty);
+            }
+        }
+        if (onFinished) onFinished();
+        return true;
+    }
+
+public:
+    StockReservation(int id, vector<ReservationLine> lines, chrono::steady_clock::time_point expiresAt,
+                     function<void()> onFinished = nullptr) {
+        this->reservationId = id;
+        this->lines = lines;
+        this->expiresAt = expiresAt;
+        this->state = ReservationState::HELD;
+        this->onFinished = onFinished;
+    }
+
+    int getId() { return reservationId; }
+    const vector<ReservationLine>& getLines() { return lines; }
+    chrono::steady_clock::time_point getExpiresAt() { return expiresAt; }
+    ReservationState getState() { return state.load(); }
+
+    // Both return false if the reservation was already finished (e.g. expired).
+    bool commit() { return finish(ReservationState::COMMITTED); }
+    bool release() { return finish(ReservationState::RELEASED); }
+};
 
-	void runReplanishment(unordered_map<int,int> itemsToReplenish){
-		if(replenishStrategy){
-			replenishStrategy->replenish(inventoryManager, itemsToReplenish);
-		}
-	}
+// Singleton
+class ReservationManager {
+private:
+    using ExpiryKey = pair<chrono::steady_clock::time_point, int>;   // (expiry, reservation id)
+
+    // Held reservations are split into shards, each ordered by expiry time
+    // behind its own small lock, so staging never contends on one global
+    // lock. A reservation leaves its shard as soon as it is committed,
+    // released or expired, so only holds still open are kept here.
+    struct ExpiryShard {
+        mutex mtx;
+        map<ExpiryKey, shared_ptr<StockReservation>> held;
+    };
+
+    static const int SHARDS = 16;
+    ExpiryShard shards[SHARDS];
+    atomic<int> nextId;
+    static ReservationManager* instance;
+    static mutex mtx;
 
-	vector<shared_ptr<Product>> getAllProducts() {
-		return inventoryManager->getAvailableProducts();
-	}
+    mutex reaperControlMtx;   // one start/stop at a time
+    mutex reaperMtx;
+    condition_variable reaperCv;
+    bool reaperStopping = false;
+    thread reaper;
 
-	int checkStock(int sku) {
-        return inventoryManager->checkStock(sku);
+    ReservationManager() {
+        nextId = 1;
     }
 
-    void removeStock(int sku, int qty) {
-        inventoryManager->removeStock(sku, qty); 
+    ExpiryShard& shardOf(int id) {
+        return shards[id % SHARDS];
     }
 
-    void addStock(int sku, int qty) {
-        inventoryManager->addStock(sku, qty);
+    void forget(ExpiryKey key) {
+        ExpiryShard& shard = shardOf(key.second);
+        lock_guard<mutex> lock(shard.mtx);
+        shard.held.erase(key);
     }
 
-    // Getters & Setters
-    void setReplenishStrategy(shared_ptr<ReplenishStrategy> strategy) {
-        this->replenishStrategy = strategy;
+public:
+    static ReservationManager* getInstance() {
+        if(instance == nullptr) {
+        	lock_guard<mutex> lock(mtx);
+        	if(instance == nullptr){
+        		instance = new ReservationManager();
+        	}
+        }
+        return instance;
     }
 
-    string getName() {
-        return this->name;
+    // Phase one: hold every line, or nothing. Returns nullptr (with any
+    // partial holds already undone) if some store can't supply its line.
+    shared_ptr<StockReservation> stage(const vector<ReservationLine>& lines, chrono::milliseconds ttl) {
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (!lines[i].store->reserveStock(lines[i].sku, lines[i].qty)) {
+                for (size_t j = 0; j < i; j++) {
+                    lines[j].store->releaseStock(lines[j].sku, lines[j].qty);
+                }
+                return nullptr;
+            }
+        }
+        auto expiresAt = chrono::steady_clock::now() + ttl;
+        int id = nextId++;
+        ExpiryKey key{expiresAt, id};
+        shared_ptr<StockReservation> reservation = make_shared<StockReservation>(id, lines, expiresAt,
+            [this, key]() { forget(key); });
+        ExpiryShard& shard = shardOf(id);
+        lock_guard<mutex> lock(shard.mtx);
+        shard.held.emplace(key, reservation);
+        return reservation;
     }
 
-    double getXCoordinate() {
-        return this->x;
+    // Releases every reservation whose TTL has passed and that nobody
+    // committed or released.
+    int expireDue(chrono::steady_clock::time_point now = chrono::steady_clock::now()) {
+        int expired = 0;
+        for (ExpiryShard& shard : shards) {
+            vector<shared_ptr<StockReservation>> due;
+            {
+                lock_guard<mutex> lock(shard.mtx);
+                auto end = shard.held.upper_bound({now, INT_MAX});
+                for (auto it = shard.held.begin(); it != end; ++it) due.push_back(it->second);
+            }
+            for (shared_ptr<StockReservation>& reservation : due) {
+                if (reservation->release()) expired++;
+            }
+        }
+        return expired;
     }
 
-    double getYCoordinate() {
-        return this->y;
+    // Reservations still held, expired or not.
+    size_t getHeldCount() {
+        size_t held = 0;
+        for (ExpiryShard& shard : shards) {
+            lock_guard<mutex> lock(shard.mtx);
+            held += shard.held.size();
+        }
+        return held;
     }
 
-    shared_ptr<InventoryManager> getInventoryManager() {
-        return this->inventoryManager;
+    // Background sweep, for servers where nobody calls expireDue() themselves.
+    void startExpiryReaper(chrono::milliseconds interval) {
+        lock_guard<mutex> control(reaperControlMtx);
+        if (reaper.joinable()) throw runtime_error("Expiry reaper already running");
+        {
+            lock_guard<mutex> lock(reaperMtx);
+            reaperStopping = false;
+        }
+        reaper = thread([this, interval]() {
+            unique_lock<mutex> lock(reaperMtx);
+            while (!reaperCv.wait_for(lock, interval, [this]() { return reaperStopping; })) {
+                lock.unlock();
+                expireDue();
+                lock.lock();
+            }
+        });
+    }
+
+    void stopExpiryReaper() {
+        lock_guard<mutex> control(reaperControlMtx);
+        {
+            lock_guard<mutex> lock(reaperMtx);
+            reaperStopping = true;
+        }
+        reaperCv.notify_all();
+        if (reaper.joinable()) reaper.join();
     }
 };
 
+ReservationManager* ReservationManager::instance = nullptr;
+mutex ReservationManager::mtx;
+
 /////////////////////////////////////////////
-// DarkStoreManager (Singleton)
+// Fulfilment Planner
 /////////////////////////////////////////////
 
-class DarkStoreManager {
+struct FulfillmentPlan {
+    vector<ReservationLine> lines;   // grouped by store, nearest store first
+    map<int,int> unfilled;           // sku -> qty no candidate store can supply
+    int partners;                    // one per store used
+    double cost;
+    bool optimal;                    // exact search finished inside the budget
+};
+
+// Chooses which stores pick a cart so that every line is covered at the
+// lowest cost, where each store used costs one delivery partner plus its
+// distance to the user (weighted set cover with quantities).
+//   - small problems: exact branch-and-bound over store subsets, with
+//     each store's coverage kept as a bitset of cart lines
+//   - large ones (or when time runs out): greedy by units per cost, then
+//     local search that drops, swaps and merges stores
+// The greedy plan is always computed first, so plan() has an answer by the
+// deadline no matter what.
+class FulfillmentPlanner {
 private:
-	vector<shared_ptr<DarkStore>> darkStores;
-    static DarkStoreManager* instance;
-    static mutex mtx;
+    static const int EXACT_MAX_STORES = 16;
+    static const int EXACT_MAX_LINES = 64;
+
+    struct Problem {
+        vector<int> skus, need;                // per cart line
+        vector<shared_ptr<DarkStore>> stores;  // nearest first
+        vector<double> distance, storeCost;
+        vector<vector<int>> stock;             // [store][line], capped at need
+        vector<uint64_t> fullMask;             // lines a store can cover on its own
+        vector<uint64_t> anyMask;              // lines a store has any stock of
+        vector<vector<int>> stockFromHere;     // [store][line]: stock in this and later stores
+    };
+
+    double partnerCost;
+    double costPerKm;
+
+    static bool feasible(const Problem& pb, const vector<int>& chosen) {
+        for (size_t l = 0; l < pb.need.size(); l++) {
+            int have = 0;
+            for (int s : chosen) have += pb.stock[s][l];
+            if (have < pb.need[l]) return false;
+        }
+        return true;
+    }
 
-    DarkStoreManager() {
-        //darkStores.resize(0);
+    static double costOf(const Problem& pb, const vector<int>& chosen) {
+        double cost = 0;
+        for (int s : chosen) cost += pb.storeCost[s];
+        return cost;
+    }
+
+    static vector<int> greedy(const Problem& pb) {
+        vector<int> remaining = pb.need;
+        vector<int> chosen;
+        vector<bool> used(pb.stores.size(), false);
+        while (true) {
+            int best = -1;
+            double bestScore = 0;
+            for (size_t s = 0; s < pb.stores.size(); s++) {
+                if (used[s]) continue;
+                int gain = 0;
+                for (size_t l = 0; l < remaining.size(); l++) gain += min(pb.stock[s][l], remaining[l]);
+                double score = gain / pb.storeCost[s];
+                if (gain > 0 && score > bestScore) {
+                    best = (int)s;
+                    bestScore = score;
+                }
+            }
+            if (best < 0) break;
+            used[best] = true;
+            chosen.push_back(best);
+            for (size_t l = 0; l < remaining.size(); l++) remaining[l] -= min(pb.stock[best][l], remaining[l]);
+        }
+        return chosen;
     }
 
+    // `chosen` stays feasible throughout, so stopping at the deadline
+    // anywhere leaves the best plan found so far.
+    static void localSearch(const Problem& pb, vector<int>& chosen, chrono::steady_clock::time_point deadline) {
+        bool improved = true;
+        while (improved && chrono::steady_clock::now() < deadline) {
+            improved = false;
+
+            // Drop stores that are no longer needed, most expensive first.
+            sort(chosen.begin(), chosen.end(), [&](int a, int b) { return pb.storeCost[a] > pb.storeCost[b]; });
+            for (size_t i = 0; i < chosen.size(); i++) {
+                if (chrono::steady_clock::now() >= deadline) return;
+                vector<int> without = chosen;
+                without.erase(without.begin() + i);
+                if (feasible(pb, without)) {
+                    chosen = without;
+                    improved = true;
+                    break;
+                }
+            }
+            if (improved) continue;
+
+            // Replace one or two chosen stores with a single cheaper one.
+            vector<bool> inPlan(pb.stores.size(), false);
+            for (int s : chosen) inPlan[s] = true;
+            for (size_t i = 0; i < chosen.size() && !improved; i++) {
+                for (size_t j = i; j < chosen.size() && !improved; j++) {
+                    double removedCost = pb.storeCost[chosen[i]] + (j != i ? pb.storeCost[chosen[j]] : 0);
+                    for (size_t u = 0; u < pb.stores.size() && !improved; u++) {
+                        if (inPlan[u] || pb.storeCost[u] >= removedCost) continue;
+                        if (chrono::steady_clock::now() >= deadline) return;
+                        vector<int> candidate;
+                        for (size_t k = 0; k < chosen.size(); k++) {
+                            if (k != i && k != j) candidate.push_back(chosen[k]);
+                        }
+                        candidate.push_back((int)u);
+                        if (feasible(pb, candidate)) {
+                            chosen = candidate;
+                            improved = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    struct ExactSearch {
+        const Problem& pb;
+        chrono::steady_clock::time_point deadline;
+        uint64_t allLines;
+        vector<int> have, chosen, best;
+        double bestCost;
+        long long nodes;
+        bool timedOut;
+
+        ExactSearch(const Problem& pb, chrono::steady_clock::time_point deadline)
+            : pb(pb), deadline(deadline) {
+            allLines = (pb.need.size() == 64) ? ~0ull : ((1ull << pb.need.size()) - 1);
+            have.assign(pb.need.size(), 0);
+            bestCost = 1e18;
+            nodes = 0;
+            timedOut = false;
+        }
+
+        uint64_t satisfiedLines() const {
+            uint64_t mask = 0;
+            for (size_t l = 0; l < have.size(); l++) {
+                if (have[l] >= pb.need[l]) mask |= 1ull << l;
+            }
+            return mask;
+        }
+
+        void search(size_t s, double cost, uint64_t satisfied) {
+            if ((++nodes & 1023) == 0 && chrono::steady_clock::now() > deadline) timedOut = true;
+            if (timedOut || cost >= bestCost) return;
+            if (satisfied == allLines) {
+                bestCost = cost;
+                best = chosen;
+                return;
+            }
+            if (s == pb.stores.size()) return;
+            // Even taking every remaining store can't cover some line.
+            for (size_t l = 0; l < have.size(); l++) {
+                if (have[l] + pb.stockFromHere[s][l] < pb.need[l]) return;
+            }
+
+            // Take store s (only worth it if it adds to an unsatisfied line)...
+            if (pb.anyMask[s] & ~satisfied) {
+                for (size_t l = 0; l < have.size(); l++) have[l] += pb.stock[s][l];
+                chosen.push_back((int)s);
+                uint64_t now = (pb.fullMask[s] & allLines) | satisfied | satisfiedLines();
+                search(s + 1, cost + pb.storeCost[s], now);
+                chosen.pop_back();
+                for (size_t l = 0; l < have.size(); l++) have[l] -= pb.stock[s][l];
+            }
+            // ...or skip it.
+            search(s + 1, cost, satisfied);
+        }
+    };
+
 public:
-	static DarkStoreManager* getInstance() {
-		if(instance == nullptr){
-			lock_guard<mutex> lock(mtx);
-			if(instance == nullptr) {
-				instance = new DarkStoreManager();
-			}
-		}
+    // Where the planner reads stock from: live stores or a snapshot.
+    typedef function<int(const shared_ptr<DarkStore>&, int)> StockLookup;
 
-		return instance;
-	}
+    FulfillmentPlanner(double partnerCost = 30.0, double costPerKm = 8.0) {
+        this->partnerCost = partnerCost;
+        this->costPerKm = costPerKm;
+    }
 
+    // `stores` should be the candidate stores, nearest first.
+    FulfillmentPlan plan(const vector<pair<int,int>>& cartLines, const vector<shared_ptr<DarkStore>>& stores,
+                         double ux, double uy, chrono::microseconds budget) const {
+        return plan(cartLines, stores, ux, uy, budget,
+                    [](const shared_ptr<DarkStore>& store, int sku) { return store->checkStock(sku); });
+    }
 
-	void registerDarkStore(shared_ptr<DarkStore> ds){
-		this->darkStores.push_back(ds);
-	}
+    FulfillmentPlan plan(const vector<pair<int,int>>& cartLines, const vector<shared_ptr<DarkStore>>& stores,
+                         double ux, double uy, chrono::microseconds budget, const StockLookup& stockOf) const {
+        auto deadline = chrono::steady_clock::now() + budget;
 
-	vector<shared_ptr<DarkStore>> getNearbyDarkStores(double ux, double uy, double maxDistance) {
-        vector<pair<double,shared_ptr<DarkStore>>> distList;
-        for (auto ds : darkStores) {
-            double d = ds->distanceTo(ux, uy);
-            if (d <= maxDistance) {
-                distList.push_back(make_pair(d, ds));
+        Problem pb;
+        map<int,int> merged;   // the same SKU may be in the cart twice
+        for (auto& [sku, qty] : cartLines) merged[sku] += qty;
+        for (auto& [sku, qty] : merged) {
+            pb.skus.push_back(sku);
+            pb.need.push_back(qty);
+        }
+        size_t lineCount = pb.skus.size();
+        for (const shared_ptr<DarkStore>& store : stores) {
+            vector<int> stock(lineCount);
+            uint64_t full = 0, any = 0;
+            for (size_t l = 0; l < lineCount; l++) {
+                stock[l] = min(max(0, stockOf(store, pb.skus[l])), pb.need[l]);
+                if (l < 64 && stock[l] > 0) any |= 1ull << l;
+                if (l < 64 && stock[l] == pb.need[l]) full |= 1ull << l;
             }
+            if (any == 0 && lineCount <= 64) continue;   // can't help at all
+            double d = store->distanceTo(ux, uy);
+            pb.stores.push_back(store);
+            pb.distance.push_back(d);
+            pb.storeCost.push_back(partnerCost + costPerKm * d);
+            pb.stock.push_back(stock);
+            pb.fullMask.push_back(full);
+            pb.anyMask.push_back(any);
         }
-        sort(distList.begin(), distList.end(),
-             [](auto &a, auto &b){ return a.first < b.first; });
 
-        vector<shared_ptr<DarkStore>> result;
-        for (auto &p : distList) {
-            result.push_back(p.second);
+        FulfillmentPlan result;
+        result.optimal = false;
+        vector<int> chosen = greedy(pb);
+        if (!feasible(pb, chosen)) {
+            // Even all stores together fall short: report what's missing.
+            vector<int> all(pb.stores.size());
+            iota(all.begin(), all.end(), 0);
+            for (size_t l = 0; l < lineCount; l++) {
+                int have = 0;
+                for (int s : all) have += pb.stock[s][l];
+                if (have < pb.need[l]) result.unfilled[pb.skus[l]] = pb.need[l] - have;
+            }
+            result.partners = 0;
+            result.cost = 0;
+            return result;
         }
+        localSearch(pb, chosen, deadline);
+
+        if (pb.stores.size() <= EXACT_MAX_STORES && lineCount <= EXACT_MAX_LINES) {
+            pb.stockFromHere.assign(pb.stores.size() + 1, vector<int>(lineCount, 0));
+            for (int s = (int)pb.stores.size() - 1; s >= 0; s--) {
+                for (size_t l = 0; l < lineCount; l++) {
+                    pb.stockFromHere[s][l] = pb.stockFromHere[s + 1][l] + pb.stock[s][l];
+                }
+            }
+            ExactSearch exact(pb, deadline);
+            exact.bestCost = costOf(pb, chosen) + 1e-9;   // greedy plan is the bound to beat
+            exact.search(0, 0.0, exact.satisfiedLines());
+            if (!exact.best.empty()) chosen = exact.best;
+            result.optimal = !exact.timedOut;
+        }
+
+        // Allocate quantities from the chosen stores, nearest first.
+        sort(chosen.begin(), chosen.end(), [&](int a, int b) { return pb.distance[a] < pb.distance[b]; });
+        vector<int> remaining = pb.need;
+        for (int s : chosen) {
+            for (size_t l = 0; l < lineCount; l++) {
+                int take = min(pb.stock[s][l], remaining[l]);
+                if (take <= 0) continue;
+                result.lines.push_back({pb.stores[s], pb.skus[l], take});
+                remaining[l] -= take;
+            }
+        }
+        result.partners = (int)chosen.size();
+        result.cost = costOf(pb, chosen);
         return result;
     }
 };
 
-DarkStoreManager* DarkStoreManager::instance = nullptr;
-mutex DarkStoreManager::mtx;
-
 /////////////////////////////////////////////
 // User & Cart
 /////////////////////////////////////////////
@@ -386,11 +2626,14 @@ public:
 
 class User {
 public:
+    static atomic<int> nextId;
+    int userId;
     string name;
     double x, y;
     shared_ptr<Cart> cart;  // User owns a cart
 
     User(string n, double x_coord, double y_coord) {
+        userId = nextId++;
         name = n;
         x = x_coord;
         y = y_coord;
@@ -402,210 +2645,1112 @@ public:
     }
 };
 
+atomic<int> User::nextId{1};
+
 /////////////////////////////////////////////
-// DeliveryPartner
+// DeliveryPartner & Dispatch
 /////////////////////////////////////////////
 
+enum class PartnerState {
+    IDLE,
+    HEADING_TO_STORE,   // assigned; can still be swapped by a rebalance
+    DELIVERING
+};
+
+// Location and state are owned by the DispatchEngine and change under its lock.
 class DeliveryPartner {
 public:
     string name;
-    DeliveryPartner(string n) {
+    int id;
+    double x, y;
+    PartnerState state;
+
+    DeliveryPartner(string n) : DeliveryPartner(0, n, 0.0, 0.0) {}
+
+    DeliveryPartner(int id, string n, double x, double y) {
+        this->id = id;
         name = n;
+        this->x = x;
+        this->y = y;
+        state = PartnerState::IDLE;
+    }
+};
+
+// One store's share of an order: collect at `store`, drop at the user.
+// The partner may be filled in (or swapped) later by the dispatcher.
+class Pickup {
+private:
+    shared_ptr<DeliveryPartner> partner;
+
+public:
+    int orderId;
+    shared_ptr<DarkStore> store;
+    double dropX, dropY;
+
+    Pickup(int orderId, shared_ptr<DarkStore> store, double dropX, double dropY) {
+        this->orderId = orderId;
+        this->store = store;
+        this->dropX = dropX;
+        this->dropY = dropY;
+    }
+
+    shared_ptr<DeliveryPartner> getPartner() const {
+        return atomic_load(&partner);
+    }
+
+    void setPartner(shared_ptr<DeliveryPartner> p) {
+        atomic_store(&partner, p);
+    }
+};
+
+// Min-cost assignment of n rows to distinct columns out of m >= n
+// (Hungarian algorithm with potentials, O(n^2 m)). Returns row -> column.
+vector<int> hungarianAssign(const vector<vector<double>>& cost) {
+    int n = cost.size(), m = n ? cost[0].size() : 0;
+    vector<double> u(n + 1, 0), v(m + 1, 0);
+    vector<int> match(m + 1, 0), way(m + 1, 0);   // match[col] = row, 1-based
+    for (int row = 1; row <= n; row++) {
+        match[0] = row;
+        int col0 = 0;
+        vector<double> minv(m + 1, DBL_MAX);
+        vector<bool> used(m + 1, false);
+        do {
+            used[col0] = true;
+            int row0 = match[col0], col1 = 0;
+            double delta = DBL_MAX;
+            for (int col = 1; col <= m; col++) {
+                if (used[col]) continue;
+                double reduced = cost[row0 - 1][col - 1] - u[row0] - v[col];
+                if (reduced < minv[col]) {
+                    minv[col] = reduced;
+                    way[col] = col0;
+                }
+                if (minv[col] < delta) {
+                    delta = minv[col];
+                    col1 = col;
+                }
+            }
+            for (int col = 0; col <= m; col++) {
+                if (used[col]) {
+                    u[match[col]] += delta;
+                    v[col] -= delta;
+                } else {
+                    minv[col] -= delta;
+                }
+            }
+            col0 = col1;
+        } while (match[col0] != 0);
+        do {
+            int col1 = way[col0];
+            match[col0] = match[col1];
+            col0 = col1;
+        } while (col0);
+    }
+    vector<int> assignment(n, -1);
+    for (int col = 1; col <= m; col++) {
+        if (match[col]) assignment[match[col] - 1] = col - 1;
+    }
+    return assignment;
+}
+
+// Singleton
+// Matches pickups to partners.
+//   - idle partners live in a UniformGridIndex, so finding the nearest
+//     ones to a store only looks at nearby cells
+//   - a new pickup takes the nearest idle partner straight away; if none is
+//     in range it waits, and dispatchPending() matches all waiting pickups
+//     in one batch (closest pairs first), looking further out for ones
+//     that have waited a while
+//   - every few rounds, pickups whose partner hasn't reached the store yet
+//     are re-matched optimally (Hungarian) against those partners plus
+//     idle ones nearby, undoing early greedy choices that aged badly
+class DispatchEngine {
+private:
+    static constexpr double PICKUP_RADIUS_KM = 5.0;
+    static const int CANDIDATES_PER_PICKUP = 4;
+    static const int REBALANCE_EVERY = 8;      // dispatch rounds between rebalances
+    static const int REBALANCE_MAX = 128;      // pickups re-matched per rebalance
+    static const int WIDEN_AFTER = 4;          // rounds before any idle partner will do
+
+    mutex dispatchMtx;
+    unordered_map<int, shared_ptr<DeliveryPartner>> partners;
+    UniformGridIndex<shared_ptr<DeliveryPartner>> idlePartners{1.0};
+    deque<pair<shared_ptr<Pickup>,int>> waiting;       // (pickup, round queued), oldest first
+    unordered_map<int, shared_ptr<Pickup>> jobOf;      // partner id -> current pickup
+    int nextPartnerId = 1;
+    int rounds = 0;
+
+    static DispatchEngine* instance;
+    static mutex mtx;
+
+    DispatchEngine() {}
+
+    static double distance(double x1, double y1, double x2, double y2) {
+        return sqrt((x1 - x2) * (x1 - x2) + (y1 - y2) * (y1 - y2));
+    }
+
+    void assign(const shared_ptr<Pickup>& pickup, const shared_ptr<DeliveryPartner>& partner) {
+        idlePartners.remove(partner->x, partner->y, partner);
+        partner->state = PartnerState::HEADING_TO_STORE;
+        jobOf[partner->id] = pickup;
+        pickup->setPartner(partner);
+    }
+
+    void makeIdle(const shared_ptr<DeliveryPartner>& partner) {
+        partner->state = PartnerState::IDLE;
+        jobOf.erase(partner->id);
+        idlePartners.insert(partner->x, partner->y, partner);
+    }
+
+    void rebalance() {
+        vector<shared_ptr<Pickup>> rows;
+        vector<shared_ptr<DeliveryPartner>> cols;
+        unordered_map<int,int> colOf;   // partner id -> column
+        auto addColumn = [&](const shared_ptr<DeliveryPartner>& p) {
+            if (colOf.count(p->id)) return;
+            colOf[p->id] = cols.size();
+            cols.push_back(p);
+        };
+        for (auto& [partnerId, pickup] : jobOf) {
+            if ((int)rows.size() == REBALANCE_MAX) break;
+            if (partners[partnerId]->state != PartnerState::HEADING_TO_STORE) continue;
+            rows.push_back(pickup);
+            addColumn(partners[partnerId]);
+        }
+        if (rows.size() < 2) return;
+        for (shared_ptr<Pickup>& pickup : rows) {
+            double sx = pickup->store->getXCoordinate(), sy = pickup->store->getYCoordinate();
+            for (auto& [d, p] : idlePartners.nearest(sx, sy, CANDIDATES_PER_PICKUP, PICKUP_RADIUS_KM)) addColumn(p);
+        }
+
+        vector<vector<double>> cost(rows.size(), vector<double>(cols.size()));
+        for (size_t r = 0; r < rows.size(); r++) {
+            double sx = rows[r]->store->getXCoordinate(), sy = rows[r]->store->getYCoordinate();
+            for (size_t c = 0; c < cols.size(); c++) {
+                double d = distance(cols[c]->x, cols[c]->y, sx, sy);
+                cost[r][c] = d <= PICKUP_RADIUS_KM ? d : 1e9;
+            }
+        }
+        vector<int> best = hungarianAssign(cost);
+
+        vector<bool> keeps(cols.size(), false);
+        for (size_t r = 0; r < rows.size(); r++) keeps[best[r]] = true;
+        for (size_t c = 0; c < cols.size(); c++) {
+            if (!keeps[c] && cols[c]->state == PartnerState::HEADING_TO_STORE) makeIdle(cols[c]);
+        }
+        for (size_t r = 0; r < rows.size(); r++) {
+            shared_ptr<DeliveryPartner> partner = cols[best[r]];
+            if (partner->state == PartnerState::IDLE) idlePartners.remove(partner->x, partner->y, partner);
+            partner->state = PartnerState::HEADING_TO_STORE;
+            jobOf[partner->id] = rows[r];
+            rows[r]->setPartner(partner);
+        }
+    }
+
+public:
+    static DispatchEngine* getInstance() {
+        if(instance == nullptr) {
+        	lock_guard<mutex> lock(mtx);
+        	if(instance == nullptr){
+        		instance = new DispatchEngine();
+        	}
+        }
+        return instance;
+    }
+
+    shared_ptr<DeliveryPartner> addPartner(string name, double x, double y) {
+        lock_guard<mutex> lock(dispatchMtx);
+        shared_ptr<DeliveryPartner> partner = make_shared<DeliveryPartner>(nextPartnerId++, name, x, y);
+        partners[partner->id] = partner;
+        idlePartners.insert(x, y, partner);
+        return partner;
+    }
+
+    // Assigns the nearest idle partner now if one is in range, else queues.
+    bool requestPickup(shared_ptr<Pickup> pickup) {
+        lock_guard<mutex> lock(dispatchMtx);
+        auto found = idlePartners.nearest(pickup->store->getXCoordinate(), pickup->store->getYCoordinate(),
+                                          1, PICKUP_RADIUS_KM);
+        if (found.empty()) {
+            waiting.push_back(make_pair(pickup, rounds));
+            return false;
+        }
+        assign(pickup, found[0].second);
+        return true;
+    }
+
+    // One batch round over every waiting pickup; returns how many got a partner.
+    // A pickup nobody is near for WIDEN_AFTER rounds takes the nearest idle
+    // partner at any distance rather than wait forever.
+    int dispatchPending() {
+        lock_guard<mutex> lock(dispatchMtx);
+        int assigned = 0;
+        if (!waiting.empty()) {
+            // Candidate (distance, pickup, partner) edges, matched closest first.
+            vector<tuple<double, size_t, shared_ptr<DeliveryPartner>>> edges;
+            for (size_t i = 0; i < waiting.size(); i++) {
+                const shared_ptr<Pickup>& pickup = waiting[i].first;
+                double sx = pickup->store->getXCoordinate(), sy = pickup->store->getYCoordinate();
+                double radius = rounds - waiting[i].second >= WIDEN_AFTER ? 1e18 : PICKUP_RADIUS_KM;
+                for (auto& [d, p] : idlePartners.nearest(sx, sy, CANDIDATES_PER_PICKUP, radius)) {
+                    edges.push_back({d, i, p});
+                }
+            }
+            sort(edges.begin(), edges.end(), [](const auto& a, const auto& b) { return get<0>(a) < get<0>(b); });
+            vector<bool> done(waiting.size(), false);
+            for (auto& [d, i, partner] : edges) {
+                if (done[i] || partner->state != PartnerState::IDLE) continue;
+                assign(waiting[i].first, partner);
+                done[i] = true;
+                assigned++;
+            }
+            deque<pair<shared_ptr<Pickup>,int>> stillWaiting;
+            for (size_t i = 0; i < waiting.size(); i++) {
+                if (!done[i]) stillWaiting.push_back(waiting[i]);
+            }
+            waiting.swap(stillWaiting);
+        }
+        if (++rounds % REBALANCE_EVERY == 0) rebalance();
+        return assigned;
+    }
+
+    // The partner has collected the pickup and is on the way to the user.
+    void pickedUp(int partnerId) {
+        lock_guard<mutex> lock(dispatchMtx);
+        auto it = partners.find(partnerId);
+        if (it == partners.end() || it->second->state != PartnerState::HEADING_TO_STORE) return;
+        shared_ptr<DeliveryPartner>& partner = it->second;
+        partner->x = jobOf[partnerId]->store->getXCoordinate();
+        partner->y = jobOf[partnerId]->store->getYCoordinate();
+        partner->state = PartnerState::DELIVERING;
+    }
+
+    // Drop-off done: the partner is idle again where they dropped it.
+    void delivered(int partnerId) {
+        lock_guard<mutex> lock(dispatchMtx);
+        auto it = partners.find(partnerId);
+        if (it == partners.end() || it->second->state != PartnerState::DELIVERING) return;
+        shared_ptr<Pickup> job = jobOf[partnerId];
+        it->second->x = job->dropX;
+        it->second->y = job->dropY;
+        makeIdle(it->second);
+    }
+
+    // Location update from the partner's app.
+    void movePartner(int partnerId, double x, double y) {
+        lock_guard<mutex> lock(dispatchMtx);
+        auto it = partners.find(partnerId);
+        if (it == partners.end()) return;
+        shared_ptr<DeliveryPartner>& partner = it->second;
+        bool indexed = partner->state == PartnerState::IDLE;
+        if (indexed) idlePartners.remove(partner->x, partner->y, partner);
+        partner->x = x;
+        partner->y = y;
+        if (indexed) idlePartners.insert(x, y, partner);
+    }
+
+    int idleCount() {
+        lock_guard<mutex> lock(dispatchMtx);
+        return idlePartners.size();
+    }
+
+    int waitingCount() {
+        lock_guard<mutex> lock(dispatchMtx);
+        return waiting.size();
     }
 };
 
+DispatchEngine* DispatchEngine::instance = nullptr;
+mutex DispatchEngine::mtx;
+
 /////////////////////////////////////////////
 // Order & OrderManager (Singleton)
 /////////////////////////////////////////////
 
 class Order {
 public:
-    static int nextId;
+    static atomic<int> nextId;
     int orderId;
     shared_ptr<User> user;
     vector<pair<shared_ptr<Product>,int>> items;     // (Product*, qty)
-    vector<shared_ptr<DeliveryPartner>> partners;
+    vector<shared_ptr<Pickup>> pickups;              // one per store, in store order
     double totalAmount;
+    chrono::system_clock::time_point placedAt;
 
     Order(shared_ptr<User> u) {
         orderId = nextId++;
         user = u;
         totalAmount = 0.0;
+        placedAt = chrono::system_clock::now();
+    }
+};
+
+atomic<int> Order::nextId{1};
+
+/////////////////////////////////////////////
+// Order History (indexed, tiered to disk)
+/////////////////////////////////////////////
+
+struct OrderLine {
+    int32_t sku;
+    int32_t qty;
+};
+
+// What history keeps of an order: IDs and numbers only.
+struct OrderRecord {
+    int orderId;
+    int userId;
+    int64_t placedAtMs;   // since the epoch
+    double total;
+    vector<OrderLine> lines;
+
+    static OrderRecord of(const Order& order) {
+        OrderRecord record;
+        record.orderId = order.orderId;
+        record.userId = order.user->userId;
+        record.placedAtMs = chrono::duration_cast<chrono::milliseconds>(order.placedAt.time_since_epoch()).count();
+        record.total = order.totalAmount;
+        for (auto& [product, qty] : order.items) record.lines.push_back({product->getSku(), qty});
+        return record;
+    }
+};
+
+// Where a page stopped. Pass it back to get the next page; a default
+// cursor starts from the beginning. It names a position by key, not by
+// offset, so orders arriving in between don't shift the pages.
+struct OrderCursor {
+    bool started = false;
+    int64_t placedAtMs = 0;
+    int orderId = 0;
+};
+
+struct OrderPage {
+    vector<OrderRecord> records;
+    OrderCursor next;
+    bool more = false;   // another page may follow
+};
+
+// Every placed order, findable by ID, by user (newest first) and by time.
+//   - the newest `hotLimit` orders are kept in memory
+//   - past that, the oldest half is appended to an archive file in one
+//     write and read back through a read-only mmap of it; only the
+//     indexes stay in memory
+//   - the archive is a cache tier, not a durable log: it is truncated
+//     when the history is created
+// Thread safe: adding takes an exclusive lock, queries a shared one.
+class OrderHistory {
+private:
+    struct ArchivedHeader {   // followed by lineCount OrderLines
+        int32_t orderId;
+        int32_t userId;
+        int64_t placedAtMs;
+        double total;
+        int32_t lineCount;
+        int32_t unused;
+    };
+
+    string archivePath;
+    size_t hotLimit;
+
+    map<int, OrderRecord> hot;                     // by order ID, oldest first
+    unordered_map<int, uint64_t> archivedAt;       // order ID -> offset in the archive
+    unordered_map<int, vector<int>> byUser;        // user ID -> order IDs, ascending
+    vector<pair<int64_t,int>> byTime;              // (placed at, order ID), ascending
+
+    int archiveFd = -1;
+    uint64_t archiveBytes = 0;
+    const char* mapped = nullptr;
+    uint64_t mappedBytes = 0;
+    mutable shared_mutex historyMtx;
+
+    static void insertSorted(vector<int>& ids, int id) {
+        if (ids.empty() || ids.back() < id) ids.push_back(id);   // the usual case
+        else ids.insert(lower_bound(ids.begin(), ids.end(), id), id);
+    }
+
+    void archiveOldest(size_t count) {
+        if (archiveFd < 0) {
+            archiveFd = ::open(archivePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (archiveFd < 0) throw runtime_error("Cannot open order archive " + archivePath);
+        }
+        string buffer;
+        for (size_t i = 0; i < count && !hot.empty(); i++) {
+            const OrderRecord& record = hot.begin()->second;
+            ArchivedHeader header = {record.orderId, record.userId, record.placedAtMs, record.total,
+                                     (int32_t)record.lines.size(), 0};
+            archivedAt[record.orderId] = archiveBytes + buffer.size();
+            buffer.append((const char*)&header, sizeof(header));
+            buffer.append((const char*)record.lines.data(), record.lines.size() * sizeof(OrderLine));
+            hot.erase(hot.begin());
+        }
+        const char* p = buffer.data();
+        size_t left = buffer.size();
+        while (left > 0) {
+            ssize_t n = ::pwrite(archiveFd, p, left, archiveBytes);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw runtime_error("Order archive write failed");
+            p += n;
+            left -= n;
+            archiveBytes += n;
+        }
+        if (mapped) munmap((void*)mapped, mappedBytes);
+        void* addr = mmap(nullptr, archiveBytes, PROT_READ, MAP_SHARED, archiveFd, 0);
+        if (addr == MAP_FAILED) throw runtime_error("Cannot map order archive " + archivePath);
+        mapped = (const char*)addr;
+        mappedBytes = archiveBytes;
+    }
+
+    // Caller holds historyMtx.
+    bool load(int orderId, OrderRecord& out) const {
+        auto hit = hot.find(orderId);
+        if (hit != hot.end()) {
+            out = hit->second;
+            return true;
+        }
+        auto at = archivedAt.find(orderId);
+        if (at == archivedAt.end()) return false;
+        ArchivedHeader header;
+        memcpy(&header, mapped + at->second, sizeof(header));
+        out.orderId = header.orderId;
+        out.userId = header.userId;
+        out.placedAtMs = header.placedAtMs;
+        out.total = header.total;
+        out.lines.resize(header.lineCount);
+        if (header.lineCount > 0) {
+            memcpy(out.lines.data(), mapped + at->second + sizeof(header), header.lineCount * sizeof(OrderLine));
+        }
+        return true;
+    }
+
+public:
+    OrderHistory(string archivePath, size_t hotLimit = 100000) {
+        this->archivePath = archivePath;
+        this->hotLimit = max<size_t>(hotLimit, 2);
+    }
+
+    ~OrderHistory() {
+        if (mapped) munmap((void*)mapped, mappedBytes);
+        if (archiveFd >= 0) ::close(archiveFd);
+    }
+
+    OrderHistory(const OrderHistory&) = delete;
+    OrderHistory& operator=(const OrderHistory&) = delete;
+
+    void add(OrderRecord record) {
+        unique_lock<shared_mutex> lock(historyMtx);
+        insertSorted(byUser[record.userId], record.orderId);
+        pair<int64_t,int> key = {record.placedAtMs, record.orderId};
+        if (byTime.empty() || byTime.back() < key) byTime.push_back(key);
+        else byTime.insert(lower_bound(byTime.begin(), byTime.end(), key), key);
+        hot.emplace(record.orderId, move(record));
+        if (hot.size() > hotLimit) archiveOldest(hot.size() - hotLimit / 2);
+    }
+
+    optional<OrderRecord> find(int orderId) const {
+        shared_lock<shared_mutex> lock(historyMtx);
+        OrderRecord record;
+        if (!load(orderId, record)) return nullopt;
+        return record;
+    }
+
+    // A user's orders, newest first.
+    OrderPage ordersOfUser(int userId, size_t limit, OrderCursor cursor = {}) const {
+        shared_lock<shared_mutex> lock(historyMtx);
+        OrderPage page;
+        auto it = byUser.find(userId);
+        if (it == byUser.end()) return page;
+        const vector<int>& ids = it->second;
+        size_t end = cursor.started ? lower_bound(ids.begin(), ids.end(), cursor.orderId) - ids.begin() : ids.size();
+        while (end > 0 && page.records.size() < limit) {
+            page.records.emplace_back();
+            load(ids[--end], page.records.back());
+        }
+        page.more = end > 0;
+        if (!page.records.empty()) page.next = {true, page.records.back().placedAtMs, page.records.back().orderId};
+        else page.next = cursor;
+        return page;
+    }
+
+    // Orders placed in [fromMs, toMs), oldest first.
+    OrderPage ordersBetween(int64_t fromMs, int64_t toMs, size_t limit, OrderCursor cursor = {}) const {
+        shared_lock<shared_mutex> lock(historyMtx);
+        OrderPage page;
+        auto it = cursor.started
+            ? upper_bound(byTime.begin(), byTime.end(), make_pair(cursor.placedAtMs, cursor.orderId))
+            : lower_bound(byTime.begin(), byTime.end(), make_pair(fromMs, INT_MIN));
+        for (; it != byTime.end() && it->first < toMs && page.records.size() < limit; ++it) {
+            page.records.emplace_back();
+            load(it->second, page.records.back());
+        }
+        page.more = it != byTime.end() && it->first < toMs;
+        if (!page.records.empty()) page.next = {true, page.records.back().placedAtMs, page.records.back().orderId};
+        else page.next = cursor;
+        return page;
+    }
+
+    size_t size() const {
+        shared_lock<shared_mutex> lock(historyMtx);
+        return byTime.size();
     }
+
+    size_t archivedCount() const {
+        shared_lock<shared_mutex> lock(historyMtx);
+        return archivedAt.size();
+    }
+};
+
+// Stock levels for a group of orders, read from each store once and then
+// kept up to date locally as orders in the group are planned. Staging still
+// goes to the real stores, so a stale snapshot only costs a re-plan.
+class InventorySnapshot {
+private:
+    unordered_map<DarkStore*, unordered_map<int,int>> stock;
+
+public:
+    int available(const shared_ptr<DarkStore>& store, int sku) {
+        unordered_map<int,int>& skus = stock[store.get()];
+        auto it = skus.find(sku);
+        if (it == skus.end()) {
+            it = skus.emplace(sku, store->checkStock(sku)).first;
+        }
+        return it->second;
+    }
+
+    void take(const vector<ReservationLine>& lines) {
+        for (const ReservationLine& line : lines) {
+            stock[line.store.get()][line.sku] = available(line.store, line.sku) - line.qty;
+        }
+    }
+
+    void clear() {
+        stock.clear();
+    }
+};
+
+enum class PlacementStatus {
+    PLACED,
+    NO_NEARBY_STORE,
+    OUT_OF_STOCK,       // no combination of nearby stores has the cart
+    STOCK_CONTENTION    // stock kept moving while we tried to reserve it
 };
 
-int Order::nextId = 1;
+struct PlacementResult {
+    PlacementStatus status;
+    shared_ptr<Order> order;          // set when PLACED
+    bool split = false;               // picked from more than one store
+    vector<ReservationLine> lines;    // which store supplies what
+    map<int,int> unfilled;            // OUT_OF_STOCK: sku -> qty missing
+};
 
 // Singleton
 class OrderManager {
 private:
-    vector<shared_ptr<Order>> orders;
+    OrderHistory history;
     static OrderManager* instance;
     static mutex mtx;
+    static string archivePath;   // empty: a per-process file in the temp directory
+
+    OrderManager(const string& archivePath) : history(archivePath) {
+    }
+
+    static string defaultArchivePath() {
+        return (filesystem::temp_directory_path() / ("order-archive-" + to_string(getpid()) + ".bin")).string();
+    }
+
+    // How long a checkout may hold stock before it is given back.
+    static constexpr chrono::milliseconds CHECKOUT_HOLD = chrono::minutes(10);
+
+    // Time the planner may spend choosing stores for one order.
+    static constexpr chrono::microseconds PLANNING_BUDGET = chrono::microseconds(2000);
+
+    FulfillmentPlanner planner;
+
+    // Reserves, commits and records one order without printing anything.
+    // Stock is staged in every store first and only taken once the whole
+    // cart is covered, so a cart that can't be filled leaves no stock behind.
+    // With a snapshot, planning reads it instead of the stores.
+    PlacementResult place(shared_ptr<User> user, shared_ptr<Cart> cart,
+                          const vector<shared_ptr<DarkStore>>& nearbyDarkStores, InventorySnapshot* snapshot) {
+        PlacementResult result;
+        if (nearbyDarkStores.empty()) {
+            result.status = PlacementStatus::NO_NEARBY_STORE;
+            return result;
+        }
+
+        StockMatrix* matrix = DarkStoreManager::getInstance()->getStockMatrix();
+        FulfillmentPlanner::StockLookup stockOf = [snapshot, matrix](const shared_ptr<DarkStore>& store, int sku) {
+            if (snapshot) return snapshot->available(store, sku);
+            int lane = store->getMatrixLane();
+            return lane >= 0 ? matrix->stockAt(lane, sku) : store->checkStock(sku);
+        };
+        vector<pair<int,int>> cartLines;
+        for (pair<shared_ptr<Product>,int>& item : cart->items) {
+            cartLines.push_back({item.first->getSku(), item.second});
+        }
+
+        // 1) Try to hold everything in the closest store
+        shared_ptr<DarkStore> firstStore = nearbyDarkStores.front();
+        vector<ReservationLine> firstStoreLines;
+        bool firstStoreHasAll = true;
+        for (auto& [sku, qty] : cartLines) {
+            firstStoreLines.push_back({firstStore, sku, qty});
+            if (snapshot && stockOf(firstStore, sku) < qty) firstStoreHasAll = false;
+        }
+        ReservationManager* reservations = ReservationManager::getInstance();
+        shared_ptr<StockReservation> reservation;
+        if (firstStoreHasAll) {
+            reservation = reservations->stage(firstStoreLines, CHECKOUT_HOLD);
+        }
+
+        // 2) Otherwise split across stores. Stock can move between planning
+        //    and staging, so re-plan a couple of times before giving up.
+        result.split = !reservation;
+        for (int attempt = 0; attempt < 3 && !reservation; attempt++) {
+            FulfillmentPlan plan = planner.plan(cartLines, nearbyDarkStores, user->x, user->y, PLANNING_BUDGET, stockOf);
+            if (!plan.unfilled.empty()) {
+                result.status = PlacementStatus::OUT_OF_STOCK;
+                result.unfilled = plan.unfilled;
+                return result;
+            }
+            reservation = reservations->stage(plan.lines, CHECKOUT_HOLD);
+            if (!reservation && snapshot) snapshot->clear();
+        }
+        if (!reservation) {
+            result.status = PlacementStatus::STOCK_CONTENTION;
+            return result;
+        }
+
+        // 3) Phase two: take the held stock and build the order
+        reservation->commit();
+        if (snapshot) snapshot->take(reservation->getLines());
+        result.lines = reservation->getLines();
+
+        shared_ptr<Order> order = make_shared<Order>(user);
+        double sum = 0;
+        for (size_t i = 0; i < result.lines.size(); i++) {
+            const ReservationLine& line = result.lines[i];
+            shared_ptr<Product> product = ProductFactory::createProduct(line.sku);
+            order->items.push_back({ product, line.qty });
+            sum += product->getPrice() * line.qty;
+        }
+        order->totalAmount = sum;
 
-    OrderManager() {
-        orders.resize(0);
+        // One delivery partner per store the order is picked from
+        for (size_t i = 0; i < result.lines.size(); i++) {
+            if (i > 0 && result.lines[i].store == result.lines[i - 1].store) continue;
+            order->pickups.push_back(make_shared<Pickup>(order->orderId, result.lines[i].store, user->x, user->y));
+        }
+        for (shared_ptr<Pickup>& pickup : order->pickups) {
+            DispatchEngine::getInstance()->requestPickup(pickup);
+        }
+        history.add(OrderRecord::of(*order));
+        result.status = PlacementStatus::PLACED;
+        result.order = order;
+        return result;
     }
 
 public:
+    // Only stores within this distance are asked to fulfil an order.
+    static constexpr double DELIVERY_RADIUS_KM = 5.0;
+
+    // Where order history spills to once it outgrows memory. The file is
+    // truncated when first used. Call before the first getInstance().
+    static void setArchivePath(const string& path) {
+        lock_guard<mutex> lock(mtx);
+        if (instance) throw runtime_error("OrderManager already created; set the archive path first");
+        archivePath = path;
+    }
+
     static OrderManager* getInstance() {
         if(instance == nullptr) {
         	lock_guard<mutex> lock(mtx);
         	if(instance == nullptr){
-        		instance = new OrderManager();
+        		instance = new OrderManager(archivePath.empty() ? defaultArchivePath() : archivePath);
         	}
         }
         return instance;
     }
 
+    // placeOrder without the printing, for callers that handle the outcome.
+    PlacementResult tryPlaceOrder(shared_ptr<User> user, shared_ptr<Cart> cart) {
+        vector<shared_ptr<DarkStore>> nearbyDarkStores = DarkStoreManager::getInstance()->getNearbyDarkStores(user->x, user->y, DELIVERY_RADIUS_KM);
+        return place(user, cart, nearbyDarkStores, nullptr);
+    }
+
+    // The same, choosing only among `stores` (nearest first).
+    PlacementResult tryPlaceOrder(shared_ptr<User> user, shared_ptr<Cart> cart,
+                                  const vector<shared_ptr<DarkStore>>& stores) {
+        return place(user, cart, stores, nullptr);
+    }
+
     void placeOrder(shared_ptr<User> user, shared_ptr<Cart> cart) {
         cout << "\n[OrderManager] Placing Order for: " << user->name << "\n";
 
-        // product --> Qty
-        vector<pair<shared_ptr<Product>,int>> requestedItems = cart->getItems();
-    
-        // 1) Find nearby dark stores within 5 KM
-        double maxDist = 5.0;
-        vector<shared_ptr<DarkStore>> nearbyDarkStores = DarkStoreManager::getInstance()->getNearbyDarkStores(user->x, user->y, maxDist);
-        
-        if (nearbyDarkStores.empty()) {
+        vector<shared_ptr<DarkStore>> nearbyDarkStores = DarkStoreManager::getInstance()->getNearbyDarkStores(user->x, user->y, DELIVERY_RADIUS_KM);
+        PlacementResult result = place(user, cart, nearbyDarkStores, nullptr);
+
+        if (result.status == PlacementStatus::NO_NEARBY_STORE) {
             cout << "  No dark stores within 5 KM. Cannot fulfill order.\n";
             return;
         }
+        if (!result.split) {
+            cout << "  All items at: " << nearbyDarkStores.front()->getName() << "\n";
+        } else {
+            cout << "  Splitting order across stores...\n";
+        }
+        if (result.status == PlacementStatus::OUT_OF_STOCK) {
+            cout << "  Could not fulfill:\n";
+            for (auto& [sku, qty] : result.unfilled) {
+                cout << "    SKU " << sku << " x" << qty << "\n";
+            }
+            cout << "  Order not placed; no stock was taken.\n";
+            return;
+        }
+        if (result.status == PlacementStatus::STOCK_CONTENTION) {
+            cout << "  Stock kept changing while reserving. Order not placed.\n";
+            return;
+        }
+
+        shared_ptr<Order> order = result.order;
+        auto partnerName = [](const shared_ptr<Pickup>& pickup) {
+            shared_ptr<DeliveryPartner> partner = pickup->getPartner();
+            return partner ? partner->name : "(waiting for a free partner)";
+        };
+        for (shared_ptr<Pickup>& pickup : order->pickups) {
+            shared_ptr<DarkStore> store = pickup->store;
+            string pname = partnerName(pickup);
+            if (result.split) {
+                cout << "   Checking: " << store->getName() << "\n";
+                for (const ReservationLine& line : result.lines) {
+                    if (line.store != store) continue;
+                    cout << "     " << store->getName() << " supplies SKU " << line.sku
+                         << " x" << line.qty << "\n";
+                }
+                cout << "     Assigned: " << pname << " for " << store->getName() << "\n";
+            } else {
+                cout << "  Assigned Delivery Partner: " << pname << "\n";
+            }
+        }
     
-        // 2) Check if closest store has all items
-        shared_ptr<DarkStore> firstStore = nearbyDarkStores.front();
+        // Printing Order Summary
+        cout << "\n[OrderManager] Order #" << order->orderId << " Summary:\n";
+        cout << "  User: " << user->name << "\n  Items:\n";
+        for (auto& item : order->items) {
+            cout << "    SKU " << item.first->getSku()
+                 << " (" << item.first->getName() << ") x" << item.second
+                 << " @ ₹" << item.first->getPrice() << "\n";
+        }
+        cout << "  Total: ₹" << order->totalAmount << "\n  Partners:\n";
+        for (shared_ptr<Pickup>& pickup : order->pickups) {
+            cout << "    " << partnerName(pickup) << "\n";
+        }
+        cout << endl;
+    }
 
-        bool allInFirst = true;
-        for (pair<shared_ptr<Product>,int>& item : requestedItems) {
+    // Places many carts at once, e.g. during a flash sale. Nothing is printed;
+    // results[i] is the outcome for batch[i].
+    //   - orders are grouped by their nearest store, and each group is
+    //     planned against one inventory snapshot
+    //   - groups whose candidate stores overlap are chained together
+    //     (union-find); chains share no store, so they run in parallel
+    //     without contending on stock
+    vector<PlacementResult> placeOrders(const vector<pair<shared_ptr<User>, shared_ptr<Cart>>>& batch) {
+        vector<PlacementResult> results(batch.size());
+        DarkStoreManager* dsManager = DarkStoreManager::getInstance();
 
-            int sku = item.first->getSku();
-            int qty = item.second;
+        vector<vector<shared_ptr<DarkStore>>> candidates(batch.size());
+        unordered_map<DarkStore*, int> storeIds;
+        vector<int> parent;
+        function<int(int)> find = [&](int v) {
+            while (parent[v] != v) v = parent[v] = parent[parent[v]];
+            return v;
+        };
+        auto storeId = [&](const shared_ptr<DarkStore>& store) {
+            auto it = storeIds.find(store.get());
+            if (it != storeIds.end()) return it->second;
+            parent.push_back((int)parent.size());
+            return storeIds[store.get()] = (int)parent.size() - 1;
+        };
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            shared_ptr<User> user = batch[i].first;
+            candidates[i] = dsManager->getNearbyDarkStores(user->x, user->y, DELIVERY_RADIUS_KM);
+            if (candidates[i].empty()) {
+                results[i].status = PlacementStatus::NO_NEARBY_STORE;
+                continue;
+            }
+            int root = find(storeId(candidates[i].front()));
+            for (shared_ptr<DarkStore>& store : candidates[i]) {
+                parent[find(storeId(store))] = root;
+            }
+        }
 
-            if (firstStore->checkStock(sku) < qty) {
-                allInFirst = false;
-                break;
+        // component -> nearest store -> orders, both in arrival order
+        map<int, vector<pair<int, vector<int>>>> components;
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (candidates[i].empty()) continue;
+            int nearestId = storeIds[candidates[i].front().get()];
+            vector<pair<int, vector<int>>>& groups = components[find(nearestId)];
+            auto group = find_if(groups.begin(), groups.end(),
+                                 [&](const pair<int, vector<int>>& g) { return g.first == nearestId; });
+            if (group == groups.end()) {
+                groups.push_back({nearestId, {}});
+                group = groups.end() - 1;
             }
+            group->second.push_back((int)i);
         }
-    
-        shared_ptr<Order> order = make_shared<Order>(user);
 
-        // One delivery partner required...
-        if (allInFirst) {
+        vector<vector<pair<int, vector<int>>>*> work;
+        for (auto& [root, groups] : components) work.push_back(&groups);
+        atomic<size_t> next{0};
+        auto worker = [&]() {
+            for (size_t w = next++; w < work.size(); w = next++) {
+                for (pair<int, vector<int>>& group : *work[w]) {
+                    InventorySnapshot snapshot;
+                    for (int i : group.second) {
+                        results[i] = place(batch[i].first, batch[i].second, candidates[i], &snapshot);
+                    }
+                }
+            }
+        };
+        size_t threads = min<size_t>(work.size(), max(1u, thread::hardware_concurrency()));
+        vector<thread> pool;
+        for (size_t t = 1; t < threads; t++) pool.emplace_back(worker);
+        worker();
+        for (thread& t : pool) t.join();
+        return results;
+    }
 
-            cout << "  All items at: " << firstStore->getName() << "\n";
+    optional<OrderRecord> getOrder(int orderId) {
+        return history.find(orderId);
+    }
 
-            // Remove the products from store
-            for (pair<shared_ptr<Product>,int>& item : requestedItems) {
-                int sku = item.first->getSku();
-                int qty = item.second;
-                firstStore->removeStock(sku, qty);
-                order->items.push_back({ item.first, qty });
-            }
+    // Newest first; pass page.next back in for the following page.
+    OrderPage getOrdersOfUser(int userId, size_t limit, OrderCursor cursor = {}) {
+        return history.ordersOfUser(userId, limit, cursor);
+    }
 
-            order->totalAmount = cart->getTotal();
-            order->partners.push_back(make_shared<DeliveryPartner>("Partner1"));
-            cout << "  Assigned Delivery Partner: Partner1\n";
-        } 
+    OrderPage getOrdersBetween(int64_t fromMs, int64_t toMs, size_t limit, OrderCursor cursor = {}) {
+        return history.ordersBetween(fromMs, toMs, limit, cursor);
+    }
+};
 
-        // Multiple delivery partners required
-        else {
-            cout << "  Splitting order across stores...\n";
+OrderManager* OrderManager::instance = nullptr;
+mutex OrderManager::mtx;
+string OrderManager::archivePath;
 
-            map<int,int> allItems; //SKU --> Qty
+/////////////////////////////////////////////
+// Work-Stealing Pool
+/////////////////////////////////////////////
 
-            for (pair<shared_ptr<Product>,int>& item : requestedItems) {
-                allItems[item.first->getSku()] = item.second;
+// Each worker owns a deque: it pushes/pops its own work at the back and,
+// when empty, steals from the front of the others'.
+class WorkStealingPool {
+private:
+    struct WorkerQueue {
+        mutex mtx;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> workers;
+    atomic<unsigned> nextQueue;
+    atomic<long long> queued;        // sitting in some deque
+    atomic<long long> outstanding;   // submitted and not yet finished
+    atomic<int> sleeping;
+    bool stopping;
+    mutex idleMtx;
+    condition_variable workAvailable;
+    condition_variable allDone;
+
+    static thread_local WorkStealingPool* currentPool;
+    static thread_local int currentWorker;
+
+    bool tryPop(int self, function<void()>& task) {
+        int count = (int)queues.size();
+        for (int i = 0; i < count; i++) {
+            WorkerQueue& queue = *queues[(self + i) % count];
+            lock_guard<mutex> lock(queue.mtx);
+            if (queue.tasks.empty()) {
+                continue;
             }
-    
-            int partnerId = 1;
-            for (shared_ptr<DarkStore> store : nearbyDarkStores) {
+            if (i == 0) {
+                task = move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
 
-                // If allItems becomes empty, we break early (all SKUs have been assigned)
-                if (allItems.empty()) break;
+    void run(int self) {
+        currentPool = this;
+        currentWorker = self;
+        while (true) {
+            function<void()> task;
+            if (tryPop(self, task)) {
+                task();
+                if (--outstanding == 0) {
+                    lock_guard<mutex> lock(idleMtx);
+                    allDone.notify_all();
+                }
+                continue;
+            }
+            unique_lock<mutex> lock(idleMtx);
+            sleeping++;
+            workAvailable.wait(lock, [this]() { return stopping || queued > 0; });
+            sleeping--;
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+    }
 
-                cout << "   Checking: " << store->getName() << "\n";
-    
-                bool assigned = false;
-                vector<int> toErase;
-                
-                for (auto& [sku, qtyNeeded] : allItems) {
+public:
+    WorkStealingPool(int threadCount = (int)max(1u, thread::hardware_concurrency())) {
+        nextQueue = 0;
+        queued = 0;
+        outstanding = 0;
+        sleeping = 0;
+        stopping = false;
+        for (int i = 0; i < threadCount; i++) {
+            queues.push_back(make_unique<WorkerQueue>());
+        }
+        for (int i = 0; i < threadCount; i++) {
+            workers.emplace_back(&WorkStealingPool::run, this, i);
+        }
+    }
 
-                    int availableQty = store->checkStock(sku);
-                    if (availableQty <= 0) continue;
-    
-                    //take whichever is smaller: available or qtyNeeded.
-                    int takenQty = min(availableQty, qtyNeeded);
-                    store->removeStock(sku, takenQty);
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> lock(idleMtx);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
 
-                    cout << "     " << store->getName() << " supplies SKU " << sku 
-                         << " x" << takenQty << "\n";
+    int getThreadCount() const {
+        return (int)workers.size();
+    }
 
-                    order->items.push_back({ ProductFactory::createProduct(sku), takenQty });
-    
-                    // Adjust the Quantity
-                    if (qtyNeeded > takenQty) {
-                        allItems[sku] = qtyNeeded - takenQty;
-                    } else {
-                        toErase.push_back(sku);
-                    }
-                    assigned = true;
-                }
+    // From a worker the task goes on that worker's own deque (it's likely
+    // follow-up work on data already in cache); otherwise round-robin.
+    void submit(function<void()> task) {
+        int target = (currentPool == this) ? currentWorker
+                                           : (int)(nextQueue++ % queues.size());
+        outstanding++;
+        {
+            lock_guard<mutex> lock(queues[target]->mtx);
+            queues[target]->tasks.push_back(move(task));
+        }
+        queued++;
+        if (sleeping > 0) {
+            lock_guard<mutex> lock(idleMtx);
+            workAvailable.notify_one();
+        }
+    }
 
-                // After iterating all SKUs in allItems, we erase 
-                // any fully‐satisfied SKUs from the allItems map.
-                for (int sku : toErase) allItems.erase(sku);
-    
-                // If at least one SKU was taken from this store, we assign 
-                // a new DeliveryPartner.
-                if (assigned) {
-                    string pname = "Partner" + to_string(partnerId++);
-                    order->partners.push_back(make_shared<DeliveryPartner>(pname));
-                    cout << "     Assigned: " << pname << " for " << store->getName() << "\n";
-                }
-            }
-    
-            //  if remaining still has entries, we print which SKUs/quantities could not be fulfilled.
-            if (!allItems.empty()) {
-                cout << "  Could not fulfill:\n";
-                for (auto& [sku, qty] : allItems) {
-                    cout << "    SKU " << sku << " x" << qty << "\n";
-                }
-            }
+    void waitIdle() {
+        unique_lock<mutex> lock(idleMtx);
+        allDone.wait(lock, [this]() { return outstanding == 0; });
+    }
+};
+
+thread_local WorkStealingPool* WorkStealingPool::currentPool = nullptr;
+thread_local int WorkStealingPool::currentWorker = -1;
+
+/////////////////////////////////////////////
+// Order Routing (Region Shards)
+/////////////////////////////////////////////
+
+// Places orders on their region's shard, on a work-stealing pool.
+//   - an order goes to the shard of the region the user is in; if that
+//     region has no store in range, to the neighbouring shard with the
+//     closest store in range
+//   - a shard's queue is drained by one pool task at a time, so shards run
+//     in parallel with each other and never share a store
+//   - a drain gives its worker back every DRAIN_BATCH orders, so one busy
+//     region can't hold a worker while others queue up; idle workers steal
+//     waiting drains
+// Register every store before submitting orders.
+class OrderRouter {
+private:
+    static const int DRAIN_BATCH = 64;
+    WorkStealingPool pool;
 
-            // recompute order->totalAmount
-            double sum = 0;
-            for (auto& item : order->items) {
-                sum += item.first->getPrice() * item.second;
+    shared_ptr<RegionShard> shardFor(const shared_ptr<User>& user) {
+        DarkStoreManager* dsManager = DarkStoreManager::getInstance();
+        double radius = OrderManager::DELIVERY_RADIUS_KM;
+        shared_ptr<RegionShard> home = dsManager->getRegionShard(user->x, user->y);
+        if (home && home->closestStore(user->x, user->y, radius)) return home;
+
+        shared_ptr<RegionShard> best;
+        double bestDistance = radius;
+        for (shared_ptr<RegionShard>& shard : dsManager->getNeighbourShards(user->x, user->y)) {
+            optional<double> d = shard->closestStore(user->x, user->y, radius);
+            if (d && *d <= bestDistance) {
+                best = shard;
+                bestDistance = *d;
             }
-            order->totalAmount = sum;
         }
-    
-        // Printing Order Summary
-        cout << "\n[OrderManager] Order #" << order->orderId << " Summary:\n";
-        cout << "  User: " << user->name << "\n  Items:\n";
-        for (auto& item : order->items) {
-            cout << "    SKU " << item.first->getSku()
-                 << " (" << item.first->getName() << ") x" << item.second
-                 << " @ ₹" << item.first->getPrice() << "\n";
+        return best;
+    }
+
+    void drain(shared_ptr<RegionShard> shard) {
+        pool.submit([this, shard]() {
+            for (int i = 0; i < DRAIN_BATCH; i++) {
+                if (!shard->runNext()) return;
+            }
+            drain(shard);
+        });
+    }
+
+public:
+    OrderRouter(int threadCount = (int)max(1u, thread::hardware_concurrency())) : pool(threadCount) {}
+
+    int getThreadCount() const {
+        return pool.getThreadCount();
+    }
+
+    // Queues the order on its shard; `done` runs on a pool worker once it is
+    // placed (or straight away when no shard has a store in range).
+    void submit(shared_ptr<User> user, shared_ptr<Cart> cart, function<void(PlacementResult)> done) {
+        shared_ptr<RegionShard> shard = shardFor(user);
+        if (!shard) {
+            PlacementResult result;
+            result.status = PlacementStatus::NO_NEARBY_STORE;
+            done(result);
+            return;
         }
-        cout << "  Total: ₹" << order->totalAmount << "\n  Partners:\n";
-        for (shared_ptr<DeliveryPartner>dp : order->partners) {
-            cout << "    " << dp->name << "\n";
+        bool idle = shard->enqueue([shard, user, cart, done]() {
+            vector<shared_ptr<DarkStore>> stores = shard->storesNear(user->x, user->y, OrderManager::DELIVERY_RADIUS_KM);
+            done(OrderManager::getInstance()->tryPlaceOrder(user, cart, stores));
+        });
+        if (idle) drain(shard);
+    }
+
+    // Submits the whole batch and waits; results[i] is the outcome for batch[i].
+    vector<PlacementResult> placeAll(const vector<pair<shared_ptr<User>, shared_ptr<Cart>>>& batch) {
+        vector<PlacementResult> results(batch.size());
+        for (size_t i = 0; i < batch.size(); i++) {
+            submit(batch[i].first, batch[i].second, [&results, i](PlacementResult r) { results[i] = move(r); });
         }
-        cout << endl;
-    
-        orders.push_back(order);   
-    }    
+        pool.waitIdle();
+        return results;
+    }
 
-    vector<shared_ptr<Order>> getAllOrders() {
-        return orders;
+    void waitIdle() {
+        pool.waitIdle();
     }
 };
 
-OrderManager* OrderManager::instance = nullptr;
-mutex OrderManager::mtx;
-
 
 /////////////////////////////////////////////
 // Main(): High-Level Flow
@@ -622,10 +3767,10 @@ public:
         map<int, double> skuToPrice;
         map<int, string> skuToName;
 
-        for (shared_ptr<DarkStore> darkStore : nearbyStores) {
-            vector<shared_ptr<Product>> products = darkStore->getAllProducts();
+        for (shared_ptr<DarkStore>& darkStore : nearbyStores) {
+            shared_ptr<const ListingSnapshot> listing = darkStore->getListing();
 
-            for (shared_ptr<Product> product : products) {
+            for (const shared_ptr<Product>& product : listing->byPrice) {
                 int sku = product->getSku();
 
                 if (skuToPrice.count(sku) == 0) {
@@ -642,6 +3787,17 @@ public:
         }
     }
 
+    // One page of a category at the nearest store, cheapest first.
+    static void showCategoryPage(shared_ptr<User> user, const string& category, size_t page, size_t pageSize) {
+        vector<shared_ptr<DarkStore>> nearest = DarkStoreManager::getInstance()->getNearestDarkStores(user->x, user->y, 1, 5.0);
+        if (nearest.empty()) return;
+        shared_ptr<const ListingSnapshot> listing = nearest.front()->getListing();
+        cout << "\n[Zepto] " << category << " at " << nearest.front()->getName() << ", page " << page + 1 << ":\n";
+        for (const Product* product : listing->categoryPage(category, page * pageSize, pageSize)) {
+            cout << "  SKU " << product->getSku() << " - " << product->getName() << " @ ₹" << product->getPrice() << "\n";
+        }
+    }
+
     static void initialize() {
         auto dsManager = DarkStoreManager::getInstance();
 
@@ -655,7 +3811,9 @@ public:
 
         // DarkStore B.......
         shared_ptr<DarkStore> darkStoreB = make_shared<DarkStore>("DarkStoreB", 4.0, 1.0);
-        darkStoreB->setReplenishStrategy(make_shared<ThresholdReplenishStrategy>(3));
+        darkStoreB->setReplenishStrategy(make_shared<WeeklyReplenishStrategy>());
+        darkStoreB->setRestockQuantity(101, 5);
+        darkStoreB->setRestockQuantity(103, 5);
 
         cout << "\nAdding stocks in DarkStoreB...." << endl; 
         darkStoreB->addStock(101, 3); // Apple
@@ -672,14 +3830,687 @@ public:
         dsManager->registerDarkStore(darkStoreA);
         dsManager->registerDarkStore(darkStoreB);
         dsManager->registerDarkStore(darkStoreC);
+
+        // Delivery partners waiting around the stores
+        DispatchEngine* dispatch = DispatchEngine::getInstance();
+        dispatch->addPartner("Partner1", 0.3, 0.2);
+        dispatch->addPartner("Partner2", 2.2, 2.7);
+        dispatch->addPartner("Partner3", 3.8, 1.3);
+        dispatch->addPartner("Partner4", 0.5, 2.5);
+        dispatch->addPartner("Partner5", 4.2, 0.6);
+        dispatch->addPartner("Partner6", 1.6, 3.5);
+    }
+};
+
+/////////////////////////////////////////////
+// Benchmarks
+/////////////////////////////////////////////
+
+// The old DbInventoryStore made safe the only way it can be: one global mutex.
+class GlobalLockInventoryStore {
+private:
+    DbInventoryStore store;
+    mutex mtx;
+public:
+    void addProduct(shared_ptr<Product> prod, int qty) {
+        lock_guard<mutex> lock(mtx);
+        store.addProduct(prod, qty);
+    }
+    bool take(int sku, int qty) {
+        lock_guard<mutex> lock(mtx);
+        if (store.checkStock(sku) < qty) return false;
+        store.removeProduct(sku, qty);
+        return true;
+    }
+    int checkStock(int sku) {
+        lock_guard<mutex> lock(mtx);
+        return store.checkStock(sku);
     }
 };
 
+// Many threads ordering the same few SKUs from one store. Checks nothing
+// is oversold and compares against the global-mutex store.
+void runInventoryContentionBenchmark(int threadCount, int ordersPerThread) {
+    const int skuCount = 8;
+    const int initialStock = threadCount * ordersPerThread / 2;   // demand outstrips supply
+    auto run = [&](const string& label, function<bool(int,int)> take, function<int(int)> stockOf) {
+        atomic<long long> sold{0};
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([&, t]() {
+                mt19937 rng(t);
+                for (int i = 0; i < ordersPerThread; i++) {
+                    int sku = 1000 + rng() % skuCount;
+                    int qty = 1 + rng() % 3;
+                    if (take(sku, qty)) sold += qty;
+                }
+            });
+        }
+        for (thread& th : threads) th.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        long long left = 0;
+        for (int s = 0; s < skuCount; s++) left += stockOf(1000 + s);
+        bool consistent = (sold + left == (long long)skuCount * initialStock);
+        cout << "  " << label << ": " << (long long)(threadCount * ordersPerThread / seconds)
+             << " orders/s, sold " << sold << ", left " << left
+             << (consistent ? " (no oversell)" : " (OVERSOLD!)") << "\n";
+    };
+
+    cout << threadCount << " threads x " << ordersPerThread << " orders on " << skuCount << " hot SKUs\n";
+
+    GlobalLockInventoryStore globalStore;
+    for (int s = 0; s < skuCount; s++) globalStore.addProduct(ProductFactory::createProduct(1000 + s), initialStock);
+    run("global mutex     ", [&](int sku, int qty) { return globalStore.take(sku, qty); },
+        [&](int sku) { return globalStore.checkStock(sku); });
+
+    ConcurrentInventoryStore concurrentStore;
+    for (int s = 0; s < skuCount; s++) concurrentStore.addProduct(ProductFactory::createProduct(1000 + s), initialStock);
+    run("per-SKU atomics  ", [&](int sku, int qty) {
+            if (!concurrentStore.reserve(sku, qty)) return false;
+            concurrentStore.commitReserved(sku, qty);
+            return true;
+        }, [&](int sku) { return concurrentStore.checkStock(sku); });
+}
+
+// Mixed stock changes from many threads against a DurableInventoryStore,
+// in both durability modes, then a restart to time recovery and check that
+// every SKU came back with the same stock. The WAL goes in a directory of
+// its own under parentDir (the temp directory if empty); only that
+// directory is ever deleted.
+void runDurableInventoryBenchmark(int threadCount, int mutationsPerThread, const string& parentDir) {
+    const int skuCount = 10000;
+    filesystem::path parent = parentDir.empty() ? filesystem::temp_directory_path() : filesystem::path(parentDir);
+    filesystem::create_directories(parent);
+    string dir = (parent / ("inventory-wal-bench-" + to_string(getpid()))).string();
+    if (!filesystem::create_directory(dir)) {
+        throw runtime_error("Benchmark WAL directory " + dir + " already exists; not touching it.");
+    }
+    cout << threadCount << " threads x " << mutationsPerThread << " stock changes on "
+         << skuCount << " SKUs, WAL in " << dir << "\n";
+
+    for (Durability mode : {Durability::GROUP_COMMIT, Durability::ASYNC}) {
+        filesystem::remove_all(dir);
+        string label = (mode == Durability::GROUP_COMMIT) ? "group commit" : "async       ";
+        vector<int> expected(skuCount);
+        double seconds;
+        long long logged = 0;
+        {
+            DurableInventoryStore store(dir, mode);
+            for (int s = 0; s < skuCount; s++) store.addProduct(ProductFactory::createProduct(1000 + s), 100);
+
+            atomic<long long> changes{0};
+            auto start = chrono::steady_clock::now();
+            vector<thread> threads;
+            for (int t = 0; t < threadCount; t++) {
+                threads.emplace_back([&, t]() {
+                    mt19937 rng(t);
+                    long long mine = 0;
+                    for (int i = 0; i < mutationsPerThread; i++) {
+                        int sku = 1000 + rng() % skuCount;
+                        int kind = rng() % 4;
+                        if (kind == 0) {
+                            store.addProduct(ProductFactory::createProduct(sku), 2);
+                        } else if (kind == 1) {
+                            store.removeProduct(sku, 1);
+                        } else if (store.reserve(sku, 1)) {
+                            store.commitReserved(sku, 1);
+                        }
+                        mine++;
+                    }
+                    changes += mine;
+                });
+            }
+            for (thread& th : threads) th.join();
+            seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            logged = changes;
+            for (int s = 0; s < skuCount; s++) expected[s] = store.checkStock(1000 + s);
+        }
+
+        auto start = chrono::steady_clock::now();
+        DurableInventoryStore reopened(dir, mode);
+        double recoveryMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        int mismatched = 0;
+        for (int s = 0; s < skuCount; s++) mismatched += (reopened.checkStock(1000 + s) != expected[s]);
+
+        cout << "  " << label << ": " << (long long)(logged / seconds) << " changes/s, recovery "
+             << fixed << setprecision(1) << recoveryMs << " ms, "
+             << (mismatched == 0 ? "all SKUs recovered" : to_string(mismatched) + " SKUs WRONG") << "\n";
+        cout.unsetf(ios::fixed);
+    }
+    filesystem::remove_all(dir);
+}
+
+// "Which of these stores can fill this cart": a checkStock call per store
+// per SKU vs. one vectorized pass over the stock matrix.
+void runStockMatrixBenchmark(int storeCount, int skuCount, int cartCount) {
+    mt19937 rng(11);
+    StockMatrix matrix(storeCount);
+    vector<shared_ptr<DarkStore>> stores;
+    for (int i = 0; i < storeCount; i++) {
+        shared_ptr<DarkStore> ds = make_shared<DarkStore>("DS" + to_string(i), 0.0, 0.0);
+        ds->mirrorStockTo(&matrix, matrix.addLane());
+        stores.push_back(ds);
+    }
+    streambuf* quiet = cout.rdbuf(nullptr);   // addStock logs every call
+    for (shared_ptr<DarkStore>& ds : stores) {
+        for (int s = 0; s < skuCount; s++) {
+            if (rng() % 3) ds->addStock(1000 + s, rng() % 12);
+        }
+    }
+    cout.rdbuf(quiet);
+
+    vector<vector<pair<int,int>>> carts(cartCount);
+    for (auto& cart : carts) {
+        for (int l = 0; l < 4; l++) cart.push_back({1000 + (int)(rng() % skuCount), 1 + (int)(rng() % 3)});
+    }
+
+    long long scanHits = 0, matrixHits = 0;
+    auto start = chrono::steady_clock::now();
+    for (auto& cart : carts) {
+        for (shared_ptr<DarkStore>& ds : stores) {
+            bool all = true;
+            for (auto& [sku, qty] : cart) {
+                if (ds->checkStock(sku) < qty) { all = false; break; }
+            }
+            scanHits += all;
+        }
+    }
+    double scanSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    for (auto& cart : carts) matrixHits += matrix.lanesThatCanFill(cart).size();
+    double matrixSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << storeCount << " stores, " << skuCount << " SKUs, " << cartCount << " carts of 4 lines\n";
+    cout << "  checkStock per store: " << (long long)(cartCount / scanSeconds) << " carts/s\n";
+    cout << "  stock matrix        : " << (long long)(cartCount / matrixSeconds) << " carts/s ("
+         << fixed << setprecision(1) << scanSeconds / matrixSeconds << "x)\n";
+    cout.unsetf(ios::fixed);
+    cout << "  stores able to fill: " << scanHits << " vs " << matrixHits
+         << (scanHits == matrixHits ? " (match)" : " (MISMATCH)") << "\n";
+}
+
+// A synthetic city under a steady order storm, driven through the real
+// OrderManager, stores and replenishment:
+//   - users live in a dozen neighbourhoods; half the stores sit near one,
+//     the rest are spread across the city
+//   - SKU demand is Zipf-like; every store carries the popular SKUs and a
+//     random share of the long tail, stocked in proportion to demand
+//   - orders arrive as a Poisson process in simulated time, and the
+//     replenishment clock moves with it, so low SKUs restock a minute later
+// The storm runs once through tryPlaceOrder, timing every order, then once
+// more through placeOrders with each simulated second as one batch.
+// No delivery partners are registered; --bench-dispatch covers dispatch.
+void runOrderStormBenchmark(int storeCount, int userCount, int orderCount) {
+    const double citySize = 20.0;                 // KM
+    const int neighbourhoods = 12, skuCount = 500, firstSku = 10000;
+    const double ordersPerSecond = 100.0;         // simulated arrival rate
+    const int lowStockThreshold = 3;
+    mt19937 rng(17);
+    uniform_real_distribution<double> coord(0.0, citySize);
+    auto clamp = [&](double v) { return min(citySize, max(0.0, v)); };
+
+    // Restocks and carts print as they go; keep that out of the report.
+    streambuf* console = cout.rdbuf(nullptr);
+
+    vector<string> categories = {"Fruits", "Vegetables", "Dairy", "Snacks", "Beverages", "Household"};
+    vector<shared_ptr<Product>> products;
+    vector<double> demand;
+    for (int i = 0; i < skuCount; i++) {
+        products.push_back(make_shared<Product>(firstSku + i, "Item" + to_string(i), 10 + rng() % 490,
+                                                categories[rng() % categories.size()]));
+        demand.push_back(1.0 / (i + 1));
+    }
+    ProductCatalog::getInstance()->load(products);
+    discrete_distribution<int> pickSku(demand.begin(), demand.end());
+
+    vector<pair<double,double>> centres;
+    for (int i = 0; i < neighbourhoods; i++) centres.push_back({coord(rng), coord(rng)});
+    normal_distribution<double> spread(0.0, 1.5);
+    auto nearCentre = [&]() {
+        pair<double,double>& c = centres[rng() % centres.size()];
+        return make_pair(clamp(c.first + spread(rng)), clamp(c.second + spread(rng)));
+    };
+
+    DarkStoreManager* dsManager = DarkStoreManager::getInstance();
+    for (int i = 0; i < storeCount; i++) {
+        pair<double,double> at = i % 2 ? nearCentre() : make_pair(coord(rng), coord(rng));
+        shared_ptr<DarkStore> store = make_shared<DarkStore>("DS" + to_string(i), at.first, at.second);
+        store->setReplenishStrategy(make_shared<ThresholdReplenishStrategy>(lowStockThreshold));
+        for (int k = 0; k < skuCount; k++) {
+            if (k >= skuCount / 5 && rng() % 10 >= 4) continue;   // 40% of the tail
+            int qty = 5 + (int)(200 * demand[k]);
+            store->setRestockQuantity(firstSku + k, qty);
+            store->addStock(firstSku + k, qty);
+        }
+        dsManager->registerDarkStore(store);
+    }
+    vector<pair<double,double>> homes(userCount);
+    for (auto& home : homes) home = nearCentre();
+
+    exponential_distribution<double> gap(ordersPerSecond);
+    double simulatedNow = 0;
+    long long clockSeconds = 0;
+    auto nextArrival = [&]() {
+        simulatedNow += gap(rng);
+        long long due = (long long)simulatedNow;
+        if (due > clockSeconds) {
+            ReplenishmentScheduler::getInstance()->advance(chrono::seconds(due - clockSeconds));
+            clockSeconds = due;
+        }
+        pair<double,double>& home = homes[rng() % homes.size()];
+        shared_ptr<User> user = make_shared<User>("U", home.first, home.second);
+        int lines = 1 + rng() % 5;
+        for (int l = 0; l < lines; l++) user->getCart()->addItem(firstSku + pickSku(rng), 1 + rng() % 3);
+        return user;
+    };
+
+    struct Tally {
+        int placed = 0, split = 0, outOfStock = 0, noStore = 0, contention = 0;
+        void count(const PlacementResult& r) {
+            if (r.status == PlacementStatus::PLACED) { placed++; split += r.split; }
+            if (r.status == PlacementStatus::OUT_OF_STOCK) outOfStock++;
+            if (r.status == PlacementStatus::NO_NEARBY_STORE) noStore++;
+            if (r.status == PlacementStatus::STOCK_CONTENTION) contention++;
+        }
+        string summary(int total) const {
+            ostringstream out;
+            out << fixed << setprecision(1) << "split " << 100.0 * split / max(1, placed) << "% of placed, stock-out "
+                << 100.0 * outOfStock / total << "%, no store " << 100.0 * noStore / total << "%, contention "
+                << 100.0 * contention / total << "%";
+            return out.str();
+        }
+    };
+    auto percentile = [](vector<double>& values, double p) {
+        size_t i = min(values.size() - 1, (size_t)(p * values.size()));
+        nth_element(values.begin(), values.begin() + i, values.end());
+        return values[i];
+    };
+
+    OrderManager* orderManager = OrderManager::getInstance();
+    Tally single;
+    vector<double> latencyUs;
+    double placingSeconds = 0;
+    for (int i = 0; i < orderCount; i++) {
+        shared_ptr<User> user = nextArrival();
+        auto start = chrono::steady_clock::now();
+        PlacementResult result = orderManager->tryPlaceOrder(user, user->getCart());
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        placingSeconds += seconds;
+        latencyUs.push_back(seconds * 1e6);
+        single.count(result);
+    }
+    double singleSimulated = simulatedNow;
+
+    Tally batched;
+    vector<double> batchMs;
+    double batchSeconds = 0;
+    long long batchedOrders = 0;
+    vector<pair<shared_ptr<User>, shared_ptr<Cart>>> batch;
+    long long window = (long long)simulatedNow;
+    auto flush = [&]() {
+        if (batch.empty()) return;
+        auto start = chrono::steady_clock::now();
+        vector<PlacementResult> results = orderManager->placeOrders(batch);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        batchSeconds += seconds;
+        batchMs.push_back(seconds * 1e3);
+        batchedOrders += batch.size();
+        for (PlacementResult& r : results) batched.count(r);
+        batch.clear();
+    };
+    for (int i = 0; i < orderCount; i++) {
+        shared_ptr<User> user = nextArrival();
+        if ((long long)simulatedNow != window) {
+            flush();
+            window = (long long)simulatedNow;
+        }
+        batch.push_back({user, user->getCart()});
+    }
+    flush();
+
+    cout.rdbuf(console);
+    cout << "Order storm: " << storeCount << " stores, " << userCount << " users in " << neighbourhoods
+         << " neighbourhoods, " << skuCount << " SKUs, " << ordersPerSecond << " orders/s simulated\n";
+    cout << fixed << setprecision(1);
+    cout << "  placeOrder : " << (long long)(orderCount / placingSeconds) << " orders/s, p50 "
+         << percentile(latencyUs, 0.50) << " us, p99 " << percentile(latencyUs, 0.99) << " us over "
+         << singleSimulated << " s simulated\n";
+    cout << "               " << single.summary(orderCount) << "\n";
+    cout << "  placeOrders: " << (long long)(batchedOrders / batchSeconds) << " orders/s, p99 batch "
+         << percentile(batchMs, 0.99) << " ms (~" << (long long)ordersPerSecond << " orders each)\n";
+    cout << "               " << batched.summary(orderCount) << "\n";
+    cout.unsetf(ios::fixed);
+}
+
+// One batch of orders over a 6x6-region city, routed to region shards by
+// OrderRouter pools of increasing size. Stock is deep enough that nothing
+// runs out, so every run does the same work.
+void runShardedRoutingBenchmark(int storeCount, int orderCount) {
+    const double citySize = 6 * DarkStoreManager::getRegionSize();
+    const int skuCount = 50, firstSku = 20000;
+    mt19937 rng(23);
+    uniform_real_distribution<double> coord(0.0, citySize);
+
+    streambuf* console = cout.rdbuf(nullptr);
+    vector<shared_ptr<Product>> products;
+    for (int i = 0; i < skuCount; i++) products.push_back(make_shared<Product>(firstSku + i, "Item" + to_string(i), 50));
+    ProductCatalog::getInstance()->load(products);
+    DarkStoreManager* dsManager = DarkStoreManager::getInstance();
+    for (int i = 0; i < storeCount; i++) {
+        shared_ptr<DarkStore> store = make_shared<DarkStore>("DS" + to_string(i), coord(rng), coord(rng));
+        for (int k = 0; k < skuCount; k++) store->addStock(firstSku + k, 1 << 24);
+        dsManager->registerDarkStore(store);
+    }
+    vector<pair<shared_ptr<User>, shared_ptr<Cart>>> batch;
+    for (int i = 0; i < orderCount; i++) {
+        shared_ptr<User> user = make_shared<User>("U", coord(rng), coord(rng));
+        int lines = 1 + rng() % 4;
+        for (int l = 0; l < lines; l++) user->getCart()->addItem(firstSku + rng() % skuCount, 1 + rng() % 2);
+        batch.push_back({user, user->getCart()});
+    }
+    cout.rdbuf(console);
+
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    cout << storeCount << " stores in " << dsManager->getRegionShards().size() << " region shards, "
+         << orderCount << " orders, " << cores << " hardware thread(s)\n";
+    double baseline = 0;
+    for (int threads = 1; threads <= (int)max(4u, cores); threads *= 2) {
+        OrderRouter router(threads);
+        auto start = chrono::steady_clock::now();
+        vector<PlacementResult> results = router.placeAll(batch);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        int placed = 0;
+        for (PlacementResult& r : results) placed += r.status == PlacementStatus::PLACED;
+        double rate = orderCount / seconds;
+        if (threads == 1) baseline = rate;
+        cout << "  " << threads << " thread(s): " << (long long)rate << " orders/s (" << fixed << setprecision(2)
+             << rate / baseline << "x), " << placed << " placed\n";
+        cout.unsetf(ios::fixed);
+    }
+}
+
+// Fills an OrderHistory with synthetic orders, most of them archived, and
+// times lookups against the old way: copy every order, then filter.
+void runOrderHistoryBenchmark(int orderCount, int userCount) {
+    const string archive = "order-history-bench.bin";
+    const int pageSize = 20;
+    mt19937 rng(31);
+    int64_t start = 1700000000000LL;   // ms; one order every 100 ms from here
+    double seconds;
+    auto timed = [&](const function<void()>& fn) {
+        auto begin = chrono::steady_clock::now();
+        fn();
+        return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    };
+
+    vector<OrderRecord> everything;   // what getAllOrders used to copy
+    {
+        OrderHistory history(archive, 100000);
+        seconds = timed([&]() {
+            for (int i = 1; i <= orderCount; i++) {
+                OrderRecord record{i, 1 + (int)(rng() % userCount), start + 100LL * i, 0, {}};
+                int lines = 1 + rng() % 4;
+                for (int l = 0; l < lines; l++) record.lines.push_back({(int32_t)(100 + rng() % 500), (int32_t)(1 + rng() % 3)});
+                record.total = 42.0 * lines;
+                everything.push_back(record);
+                history.add(move(record));
+            }
+        });
+        cout << orderCount << " orders from " << userCount << " users: " << history.archivedCount()
+             << " archived, " << (long long)(orderCount / seconds) << " adds/s\n";
+
+        const int lookups = 100000;
+        long long found = 0;
+        seconds = timed([&]() {
+            for (int i = 0; i < lookups; i++) found += history.find(1 + rng() % orderCount).has_value();
+        });
+        cout << "  by ID          : " << fixed << setprecision(2) << seconds * 1e6 / lookups << " us ("
+             << found << "/" << lookups << " found)\n";
+
+        const int queries = 10000;
+        seconds = timed([&]() {
+            for (int i = 0; i < queries; i++) history.ordersOfUser(1 + rng() % userCount, pageSize);
+        });
+        cout << "  user, 1st page : " << seconds * 1e6 / queries << " us\n";
+
+        size_t walked = 0, pages = 0;
+        seconds = timed([&]() {
+            OrderPage page;
+            do {
+                page = history.ordersOfUser(1, 5, page.next);
+                walked += page.records.size();
+                pages++;
+            } while (page.more);
+        });
+        cout << "  user 1, by 5s  : " << walked << " orders in " << pages << " pages, "
+             << seconds * 1e3 << " ms\n";
+
+        seconds = timed([&]() {
+            for (int i = 0; i < queries; i++) {
+                int64_t from = start + 100LL * (rng() % orderCount);
+                history.ordersBetween(from, from + 60000, pageSize);
+            }
+        });
+        cout << "  minute window  : " << seconds * 1e6 / queries << " us per page\n";
+    }
+    unlink(archive.c_str());
+
+    const int copies = 5;
+    size_t matched = 0;
+    seconds = timed([&]() {
+        for (int i = 0; i < copies; i++) {
+            vector<OrderRecord> copy = everything;
+            int userId = 1 + rng() % userCount;
+            for (OrderRecord& record : copy) matched += record.userId == userId;
+        }
+    });
+    cout << "  copy + filter  : " << seconds * 1e3 / copies << " ms per user query\n";
+    cout.unsetf(ios::fixed);
+}
+
+// City simulation: orders arrive at random stores, partners collect them a
+// few ticks after assignment, deliver, and go back to wait near a store.
+// Times only the dispatcher calls. Then compares greedy matching against
+// the Hungarian optimum on one large batch.
+void runDispatchBenchmark(int partnerCount, int orderCount) {
+    const double citySize = 30.0;   // KM
+    const int storeCount = 150, ordersPerTick = 50, ticksToPickup = 3, ticksToDeliver = 6;
+    mt19937 rng(5);
+    uniform_real_distribution<double> coord(0.0, citySize);
+    DispatchEngine* dispatch = DispatchEngine::getInstance();
+
+    vector<shared_ptr<DarkStore>> stores;
+    for (int i = 0; i < storeCount; i++) {
+        stores.push_back(make_shared<DarkStore>("DS" + to_string(i), coord(rng), coord(rng)));
+    }
+    for (int i = 0; i < partnerCount; i++) {
+        dispatch->addPartner("P" + to_string(i), coord(rng), coord(rng));
+    }
+
+    struct Open { shared_ptr<Pickup> pickup; int assignedAt; };
+    vector<Open> open;
+    multimap<int,int> deliveries;   // tick -> partner id
+    double dispatchSeconds = 0, pickupKm = 0;
+    int submitted = 0, collected = 0;
+    auto timed = [&](const function<void()>& fn) {
+        auto start = chrono::steady_clock::now();
+        fn();
+        dispatchSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    for (int tick = 0; collected < orderCount; tick++) {
+        for (int i = 0; i < ordersPerTick && submitted < orderCount; i++, submitted++) {
+            shared_ptr<DarkStore> store = stores[rng() % storeCount];
+            shared_ptr<Pickup> pickup = make_shared<Pickup>(submitted, store,
+                store->getXCoordinate() + coord(rng) / 10, store->getYCoordinate() + coord(rng) / 10);
+            timed([&]() { dispatch->requestPickup(pickup); });
+            open.push_back({pickup, -1});
+        }
+        timed([&]() { dispatch->dispatchPending(); });
+
+        vector<Open> stillOpen;
+        for (Open& o : open) {
+            shared_ptr<DeliveryPartner> partner = o.pickup->getPartner();
+            if (partner && o.assignedAt < 0) o.assignedAt = tick;
+            if (partner && tick - o.assignedAt >= ticksToPickup) {
+                pickupKm += o.pickup->store->distanceTo(partner->x, partner->y);
+                timed([&]() { dispatch->pickedUp(partner->id); });
+                deliveries.insert({tick + ticksToDeliver, partner->id});
+                collected++;
+            } else {
+                stillOpen.push_back(o);
+            }
+        }
+        open.swap(stillOpen);
+        for (auto it = deliveries.begin(); it != deliveries.end() && it->first <= tick; it = deliveries.erase(it)) {
+            // Done, then head back to wait near some store.
+            int partnerId = it->second;
+            shared_ptr<DarkStore> home = stores[rng() % storeCount];
+            timed([&]() {
+                dispatch->delivered(partnerId);
+                dispatch->movePartner(partnerId, home->getXCoordinate(), home->getYCoordinate());
+            });
+        }
+    }
+    cout << partnerCount << " partners, " << storeCount << " stores, " << orderCount << " orders\n";
+    cout << "  dispatcher: " << (long long)(orderCount / dispatchSeconds) << " orders/s, mean partner->store "
+         << fixed << setprecision(2) << pickupKm / collected << " km\n";
+
+    // Greedy vs. optimal on one batch of 300 pickups and 400 idle partners.
+    const int rows = 300, cols = 400;
+    vector<pair<double,double>> pickupAt(rows), partnerAt(cols);
+    for (auto& p : pickupAt) p = {coord(rng), coord(rng)};
+    for (auto& p : partnerAt) p = {coord(rng), coord(rng)};
+    vector<vector<double>> cost(rows, vector<double>(cols));
+    vector<tuple<double,int,int>> edges;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            cost[r][c] = hypot(pickupAt[r].first - partnerAt[c].first, pickupAt[r].second - partnerAt[c].second);
+            edges.push_back({cost[r][c], r, c});
+        }
+    }
+    sort(edges.begin(), edges.end());
+    vector<bool> rowDone(rows, false), colDone(cols, false);
+    double greedyKm = 0;
+    for (auto& [d, r, c] : edges) {
+        if (rowDone[r] || colDone[c]) continue;
+        rowDone[r] = colDone[c] = true;
+        greedyKm += d;
+    }
+    auto start = chrono::steady_clock::now();
+    vector<int> best = hungarianAssign(cost);
+    double hungarianMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    double optimalKm = 0;
+    for (int r = 0; r < rows; r++) optimalKm += cost[r][best[r]];
+    cout << "  one batch of " << rows << ": greedy " << greedyKm << " km, Hungarian " << optimalKm
+         << " km (" << hungarianMs << " ms)\n";
+    cout.unsetf(ios::fixed);
+}
+
+// Grid index vs. the old "distance to every store, then sort" lookup.
+void runSpatialIndexBenchmark(int storeCount, int queryCount) {
+    const double citySize = 40.0;   // KM
+    const double radius = 5.0;
+    mt19937 rng(42);
+    uniform_real_distribution<double> coord(0.0, citySize);
+
+    vector<shared_ptr<DarkStore>> stores;
+    UniformGridIndex<shared_ptr<DarkStore>> index(radius / 2);
+    for (int i = 0; i < storeCount; i++) {
+        shared_ptr<DarkStore> ds = make_shared<DarkStore>("DS" + to_string(i), coord(rng), coord(rng));
+        stores.push_back(ds);
+        index.insert(ds->getXCoordinate(), ds->getYCoordinate(), ds);
+    }
+    vector<pair<double,double>> queries;
+    for (int i = 0; i < queryCount; i++) {
+        queries.push_back({coord(rng), coord(rng)});
+    }
+
+    size_t scanFound = 0;
+    auto start = chrono::steady_clock::now();
+    for (auto& q : queries) {
+        vector<pair<double,shared_ptr<DarkStore>>> distList;
+        for (auto& ds : stores) {
+            double d = ds->distanceTo(q.first, q.second);
+            if (d <= radius) distList.push_back(make_pair(d, ds));
+        }
+        sort(distList.begin(), distList.end(), [](auto &a, auto &b){ return a.first < b.first; });
+        scanFound += distList.size();
+    }
+    double scanSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t gridFound = 0;
+    start = chrono::steady_clock::now();
+    for (auto& q : queries) {
+        gridFound += index.withinRadius(q.first, q.second, radius).size();
+    }
+    double gridSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t knnFound = 0;
+    start = chrono::steady_clock::now();
+    for (auto& q : queries) {
+        knnFound += index.nearest(q.first, q.second, 5, radius).size();
+    }
+    double knnSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << fixed << setprecision(2);
+    cout << storeCount << " stores, " << queryCount << " queries, radius " << radius << " KM\n";
+    cout << "  scan + sort : " << scanSeconds * 1e6 / queryCount << " us/query (" << scanFound << " hits)\n";
+    cout << "  grid radius : " << gridSeconds * 1e6 / queryCount << " us/query (" << gridFound << " hits)\n";
+    cout << "  grid 5-NN   : " << knnSeconds * 1e6 / queryCount << " us/query (" << knnFound << " hits)\n";
+    if (scanFound != gridFound) {
+        cout << "  MISMATCH between scan and grid results!\n";
+    }
+}
+
 /////////////////////////////////////////////
 // Main(): High-Level Flow
 /////////////////////////////////////////////
 
-int main() {
+int main(int argc, char* argv[]) {
+
+    if (argc >= 2 && string(argv[1]) == "--bench-spatial") {
+        runSpatialIndexBenchmark(argc >= 3 ? stoi(argv[2]) : 5000, argc >= 4 ? stoi(argv[3]) : 20000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-orders") {
+        runOrderStormBenchmark(argc >= 3 ? stoi(argv[2]) : 200, argc >= 4 ? stoi(argv[3]) : 20000,
+                               argc >= 5 ? stoi(argv[4]) : 20000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-history") {
+        runOrderHistoryBenchmark(argc >= 3 ? stoi(argv[2]) : 1000000, argc >= 4 ? stoi(argv[3]) : 50000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-shards") {
+        runShardedRoutingBenchmark(argc >= 3 ? stoi(argv[2]) : 720, argc >= 4 ? stoi(argv[3]) : 100000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-dispatch") {
+        runDispatchBenchmark(argc >= 3 ? stoi(argv[2]) : 2000, argc >= 4 ? stoi(argv[3]) : 50000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-matrix") {
+        runStockMatrixBenchmark(argc >= 3 ? stoi(argv[2]) : 512, argc >= 4 ? stoi(argv[3]) : 2000,
+                                argc >= 5 ? stoi(argv[4]) : 20000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-durable") {
+        runDurableInventoryBenchmark(argc >= 3 ? stoi(argv[2]) : 32, argc >= 4 ? stoi(argv[3]) : 20000,
+                                     argc >= 5 ? argv[4] : "");
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-inventory") {
+        runInventoryContentionBenchmark(argc >= 3 ? stoi(argv[2]) : 8, argc >= 4 ? stoi(argv[3]) : 200000);
+        return 0;
+    }
+    if (argc >= 3 && string(argv[1]) == "--catalog") {
+        ProductCatalog::getInstance()->loadFromFile(argv[2]);
+        cout << "[Catalog] Loaded " << ProductCatalog::getInstance()->size() << " products from " << argv[2] << endl;
+    }
 
     // 1) Initialize.
     ZeptoHelper::initialize();
@@ -690,6 +4521,7 @@ int main() {
 
     // 3) Show all available items via Zepto
     ZeptoHelper::showAllItems(user);
+    ZeptoHelper::showCategoryPage(user, "Fruits", 0, 10);
 
     // 4) User adds items to cart (some not in a single store)
     cout<<"\nAdding items to cart\n";
@@ -700,6 +4532,53 @@ int main() {
 
     // 5) Place Order
     OrderManager::getInstance()->placeOrder(user, user->cart);
+
+    // 6) An abandoned checkout: its held stock comes back once the hold expires
+    shared_ptr<DarkStore> nearest = DarkStoreManager::getInstance()->getNearestDarkStores(user->x, user->y, 1, 5.0).front();
+    int applesBefore = nearest->checkStock(101);
+    shared_ptr<StockReservation> abandoned = ReservationManager::getInstance()->stage(
+        {{nearest, 101, 1}}, chrono::milliseconds(20));
+    cout << "[Checkout] Holding 1 x SKU 101 at " << nearest->getName() << ": stock "
+         << applesBefore << " -> " << nearest->checkStock(101) << "\n";
+    this_thread::sleep_for(chrono::milliseconds(30));
+    int expired = ReservationManager::getInstance()->expireDue();
+    cout << "[Checkout] " << expired << " hold(s) expired, stock back to " << nearest->checkStock(101) << "\n";
+
+    // 7) A small flash-sale burst placed as one batch
+    cout << "\nFlash sale: placing a batch of carts\n";
+    vector<pair<shared_ptr<User>, shared_ptr<Cart>>> batch;
+    vector<tuple<string,double,double,int,int>> shoppers = {
+        {"Riya", 0.5, 0.5, 201, 2}, {"Kabir", 3.5, 1.0, 103, 3}, {"Meera", 2.0, 2.5, 102, 2}, {"Arjun", 1.5, 0.5, 201, 9}
+    };
+    for (auto& [name, x, y, sku, qty] : shoppers) {
+        shared_ptr<User> shopper = make_shared<User>(name, x, y);
+        shopper->getCart()->addItem(sku, qty);
+        batch.push_back({shopper, shopper->getCart()});
+    }
+    vector<PlacementResult> results = OrderManager::getInstance()->placeOrders(batch);
+    for (size_t i = 0; i < results.size(); i++) {
+        cout << "  " << batch[i].first->name << ": ";
+        if (results[i].status == PlacementStatus::PLACED) {
+            cout << "order #" << results[i].order->orderId << ", " << results[i].order->pickups.size()
+                 << " partner(s), ₹" << results[i].order->totalAmount << "\n";
+        } else {
+            cout << "not placed\n";
+        }
+    }
+
+    // 8) Replenishment: stores that ran low restock together after the batching
+    //    window; DarkStoreB gets its standing order once the week is up.
+    cout << "\nReplenishment: one minute later\n";
+    ReplenishmentScheduler::getInstance()->advance(chrono::minutes(1));
+    cout << "\nReplenishment: one week later\n";
+    ReplenishmentScheduler::getInstance()->advance(chrono::hours(24 * 7));
+
+    // 9) Order history: a page at a time, newest first
+    cout << "\nOrder history for " << user->name << ":\n";
+    OrderPage page = OrderManager::getInstance()->getOrdersOfUser(user->userId, 10);
+    for (OrderRecord& record : page.records) {
+        cout << "  Order #" << record.orderId << ": " << record.lines.size() << " line(s), ₹" << record.total << "\n";
+    }
     return 0;
 }
 